@@ -1,16 +1,36 @@
+#include <chrono>
+#include <cstdio>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #include <Halide.h>
+#include <png.h>
+#include <tiffio.h>
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <include/stb_image_write.h>
 
 #include <hdrplus_pipeline.h>
+#include <hdrplus_pipeline_linear.h>
+#include <hdrplus_pipeline_preview.h>
+#include <hdrplus_pipeline_telemetry.h>
+#include <hdrplus_pipeline_u16.h>
+#include <src/AlignmentTelemetry.h>
 #include <src/Burst.h>
+#include <src/ReferenceSelection.h>
+#include <src/StripRenderer.h>
+
+/*
+ * Roi -- A rectangle of the output image to render. An empty one (the default)
+ * stands for the whole image.
+ */
+struct Roi {
+  int x = 0, y = 0, width = 0, height = 0;
+};
 
 /*
  * HDRPlus Class -- Houses file I/O, defines pipeline attributes and calls
@@ -20,17 +40,61 @@ class HDRPlus {
   const Burst &burst;
 
 public:
+  // strengths of the optional finishing stages
+  static constexpr float sharpen_strength = 2.f;
+  static constexpr float contrast_strength = 5.f;
+
   const Compression c;
   const Gain g;
+  const bool telemetry;
+  const bool sharpest_reference;
+  const bool preview;
+  const Roi roi;
+  // 16-bit formats are rendered at full resolution without telemetry
+  const OutputFormat format;
+  // enables chroma denoising and sharpening, except in previews
+  const bool enhance;
+
+  HDRPlus(const Burst &burst, const Compression c, const Gain g,
+          const bool telemetry = false, const bool sharpest_reference = false,
+          const bool preview = false, const Roi roi = Roi(),
+          const OutputFormat format = OutputFormat::U8,
+          const bool enhance = false)
+      : burst(burst), c(c), g(g), telemetry(telemetry),
+        sharpest_reference(sharpest_reference), preview(preview), roi(roi),
+        format(format), enhance(enhance) {}
+
+  // T is uint8_t for the U8 format and uint16_t for the 16-bit ones
+  template <typename T = uint8_t> Halide::Runtime::Buffer<T> process() {
+    if ((format == OutputFormat::U8) != std::is_same_v<T, uint8_t>) {
+      throw std::invalid_argument(
+          "The output type of HDRPlus does not match its format.");
+    }
+    if (format != OutputFormat::U8 && (preview || telemetry)) {
+      throw std::invalid_argument(
+          "16-bit output is not supported by previews or telemetry.");
+    }
 
-  HDRPlus(const Burst &burst, const Compression c, const Gain g)
-      : burst(burst), c(c), g(g) {}
+    // previews are binned to half the width and height, except with
+    // telemetry, which only the full resolution pipeline reports
+    const bool binned = preview && !telemetry;
+    const int width = binned ? burst.GetWidth() / 2 : burst.GetWidth();
+    const int height = binned ? burst.GetHeight() / 2 : burst.GetHeight();
 
-  Halide::Runtime::Buffer<uint8_t> process() {
-    const int width = burst.GetWidth();
-    const int height = burst.GetHeight();
+    // the pipeline renders the region of its output buffer, computing only
+    // the tiles (and stencil halos) that this region depends on
 
-    Halide::Runtime::Buffer<uint8_t> output_img(3, width, height);
+    Halide::Runtime::Buffer<T> output_img(3, width, height);
+    if (roi.width > 0 && roi.height > 0) {
+      if (roi.x < 0 || roi.y < 0 || roi.x + roi.width > width ||
+          roi.y + roi.height > height) {
+        throw std::invalid_argument(
+            "The region of interest must lie within the " +
+            std::to_string(width) + "x" + std::to_string(height) + " output.");
+      }
+      output_img = Halide::Runtime::Buffer<T>(3, roi.width, roi.height);
+      output_img.set_min({0, roi.x, roi.y});
+    }
 
     std::cerr << "Black point: " << burst.GetBlackLevel() << std::endl;
     std::cerr << "White point: " << burst.GetWhiteLevel() << std::endl;
@@ -46,10 +110,58 @@ public:
           "two channels.");
     }
 
+    if (sharpest_reference) {
+      double scoring_ms = 0;
+      const int reference = SelectSharpestReference(imgs, scoring_ms);
+      std::cerr << "Reference frame: " << reference << " (scored in "
+                << scoring_ms << " ms)" << std::endl;
+    }
+
     const int cfa_pattern = static_cast<int>(burst.GetCfaPattern());
     auto ccm = burst.GetColorCorrectionMatrix();
-    hdrplus_pipeline(imgs, burst.GetBlackLevel(), burst.GetWhiteLevel(), wb.r,
-                     wb.g0, wb.g1, wb.b, cfa_pattern, ccm, c, g, output_img);
+
+    // chroma denoising and sharpening are opt in (-e); previews skip them and
+    // tone map in one pass
+    const bool enhanced = enhance && !preview;
+    const bool multi_pass = !preview;
+
+    if (telemetry) {
+      auto telemetry_buffer = AllocateAlignmentTelemetry();
+      const auto start = std::chrono::steady_clock::now();
+      hdrplus_pipeline_telemetry(imgs, burst.GetBlackLevel(),
+                                 burst.GetWhiteLevel(), wb.r, wb.g0, wb.g1,
+                                 wb.b, cfa_pattern, ccm, c, g, enhanced,
+                                 enhanced, sharpen_strength, multi_pass,
+                                 contrast_strength, output_img,
+                                 telemetry_buffer);
+      const auto end = std::chrono::steady_clock::now();
+      PrintAlignmentTelemetry(
+          telemetry_buffer,
+          std::chrono::duration<double, std::milli>(end - start).count(),
+          std::cerr);
+    } else if (binned) {
+      hdrplus_pipeline_preview(imgs, burst.GetBlackLevel(),
+                               burst.GetWhiteLevel(), wb.r, wb.g0, wb.g1, wb.b,
+                               cfa_pattern, ccm, c, g, enhanced,
+                               enhanced, sharpen_strength, multi_pass,
+                               contrast_strength, output_img);
+    } else if (format == OutputFormat::U16) {
+      hdrplus_pipeline_u16(imgs, burst.GetBlackLevel(), burst.GetWhiteLevel(),
+                           wb.r, wb.g0, wb.g1, wb.b, cfa_pattern, ccm, c, g,
+                           enhanced, enhanced, sharpen_strength,
+                           multi_pass, contrast_strength, output_img);
+    } else if (format == OutputFormat::U16Linear) {
+      hdrplus_pipeline_linear(imgs, burst.GetBlackLevel(),
+                              burst.GetWhiteLevel(), wb.r, wb.g0, wb.g1, wb.b,
+                              cfa_pattern, ccm, c, g, enhanced,
+                              enhanced, sharpen_strength, multi_pass,
+                              contrast_strength, output_img);
+    } else {
+      hdrplus_pipeline(imgs, burst.GetBlackLevel(), burst.GetWhiteLevel(),
+                       wb.r, wb.g0, wb.g1, wb.b, cfa_pattern, ccm, c, g,
+                       enhanced, enhanced, sharpen_strength,
+                       multi_pass, contrast_strength, output_img);
+    }
 
     // transpose to account for interleaved layout
     output_img.transpose(0, 1);
@@ -71,20 +183,181 @@ public:
     }
     return true;
   }
+
+  static bool save_tiff(const std::string &dir_path,
+                        const std::string &img_name,
+                        const Halide::Runtime::Buffer<uint16_t> &img);
 };
 
+/*
+ * PngRowWriter -- Writes an 8-bit RGB PNG row by row, so that an image
+ * rendered in strips is never held whole.
+ */
+class PngRowWriter {
+  FILE *file = nullptr;
+  png_structp png = nullptr;
+  png_infop info = nullptr;
+
+  void close() {
+    png_destroy_write_struct(&png, &info);
+    if (file) {
+      std::fclose(file);
+      file = nullptr;
+    }
+  }
+
+public:
+  PngRowWriter(const std::string &path, int width, int height) {
+    file = std::fopen(path.c_str(), "wb");
+    png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr,
+                                  nullptr);
+    info = png ? png_create_info_struct(png) : nullptr;
+    if (!file || !info || setjmp(png_jmpbuf(png))) {
+      close();
+      throw std::runtime_error("Unable to write output image '" + path + "'");
+    }
+    png_init_io(png, file);
+    png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGB,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+                 PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+  }
+
+  ~PngRowWriter() { close(); }
+
+  PngRowWriter(const PngRowWriter &) = delete;
+  PngRowWriter &operator=(const PngRowWriter &) = delete;
+
+  // Appends the rows of an interleaved (c, x, y) strip.
+  void write_rows(const Halide::Runtime::Buffer<uint8_t> &strip) {
+    if (setjmp(png_jmpbuf(png))) {
+      throw std::runtime_error("Unable to write output image rows");
+    }
+    for (int y = strip.dim(2).min(); y <= strip.dim(2).max(); y++) {
+      png_write_row(png, const_cast<png_bytep>(&strip(0, 0, y)));
+    }
+  }
+
+  void finish() {
+    if (setjmp(png_jmpbuf(png))) {
+      throw std::runtime_error("Unable to write output image");
+    }
+    png_write_end(png, nullptr);
+  }
+};
+
+/*
+ * TiffRowWriter -- Writes a 16-bit RGB TIFF row by row with libtiff, straight
+ * from the rows of the output buffer, so that no second copy of the image is
+ * made and an image rendered in strips is never held whole.
+ */
+class TiffRowWriter {
+  TIFF *tiff = nullptr;
+  uint32_t row = 0;
+
+public:
+  TiffRowWriter(const std::string &path, int width, int height) {
+    tiff = TIFFOpen(path.c_str(), "w");
+    if (!tiff) {
+      throw std::runtime_error("Unable to write output image '" + path + "'");
+    }
+    TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, uint32_t(width));
+    TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, uint32_t(height));
+    TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, uint16_t(3));
+    TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, uint16_t(16));
+    TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+    TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    TIFFSetField(tiff, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+    TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tiff, 0));
+  }
+
+  ~TiffRowWriter() {
+    if (tiff) {
+      TIFFClose(tiff);
+    }
+  }
+
+  TiffRowWriter(const TiffRowWriter &) = delete;
+  TiffRowWriter &operator=(const TiffRowWriter &) = delete;
+
+  // Appends one row of interleaved RGB samples.
+  void write_row(const uint16_t *samples) {
+    if (TIFFWriteScanline(tiff, const_cast<uint16_t *>(samples), row++) < 0) {
+      throw std::runtime_error("Unable to write output image rows");
+    }
+  }
+
+  // Appends the rows of an interleaved (c, x, y) strip.
+  void write_rows(const Halide::Runtime::Buffer<uint16_t> &strip) {
+    for (int y = strip.dim(2).min(); y <= strip.dim(2).max(); y++) {
+      write_row(&strip(0, 0, y));
+    }
+  }
+
+  void finish() {
+    if (!TIFFFlush(tiff)) {
+      throw std::runtime_error("Unable to write output image");
+    }
+  }
+};
+
+/*
+ * save_tiff -- Writes the (x, y, c) output of HDRPlus::process, interleaved
+ * in memory, as a 16-bit TIFF.
+ */
+bool HDRPlus::save_tiff(const std::string &dir_path,
+                        const std::string &img_name,
+                        const Halide::Runtime::Buffer<uint16_t> &img) {
+  try {
+    TiffRowWriter writer(dir_path + "/" + img_name, img.width(),
+                         img.height());
+    for (int y = img.dim(1).min(); y <= img.dim(1).max(); y++) {
+      writer.write_row(&img(img.dim(0).min(), y, img.dim(2).min()));
+    }
+    writer.finish();
+  } catch (const std::runtime_error &) {
+    std::cerr << "Unable to write output image '" << img_name << "'"
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/*
+ * is_tiff -- Whether an output file name selects TIFF output.
+ */
+static bool is_tiff(const std::string &name) {
+  for (const std::string extension : {".tif", ".tiff", ".TIF", ".TIFF"}) {
+    if (name.size() > extension.size() &&
+        name.compare(name.size() - extension.size(), extension.size(),
+                     extension) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
 int main(int argc, char *argv[]) {
 
   if (argc < 5) {
     std::cerr << "Usage: " << argv[0]
-              << " [-c comp -g gain (optional)] dir_path out_img raw_img1 "
-                 "raw_img2 [...]"
+              << " [-c comp -e -g gain -l -m mib -p -r -s rows -t "
+                 "-w x,y,w,h (optional)] dir_path out_img raw_img1 raw_img2 "
+                 "[...]"
               << std::endl;
     return 1;
   }
 
   Compression c = 3.8f;
   Gain g = 1.1f;
+  bool telemetry = false;
+  bool sharpest_reference = false;
+  bool preview = false;
+  bool enhance = false;
+  bool linear = false;
+  Roi roi;
+  int strip_rows = 0;
+  int strip_budget_mib = 0;
 
   int i = 1;
 
@@ -93,10 +366,47 @@ int main(int argc, char *argv[]) {
       c = std::stof(argv[++i]);
       i++;
       continue;
+    } else if (argv[i][1] == 'e') {
+      enhance = true;
+      i++;
+      continue;
     } else if (argv[i][1] == 'g') {
       g = std::stof(argv[++i]);
       i++;
       continue;
+    } else if (argv[i][1] == 'l') {
+      linear = true;
+      i++;
+      continue;
+    } else if (argv[i][1] == 'm') {
+      strip_budget_mib = std::stoi(argv[++i]);
+      i++;
+      continue;
+    } else if (argv[i][1] == 'p') {
+      preview = true;
+      i++;
+      continue;
+    } else if (argv[i][1] == 'r') {
+      sharpest_reference = true;
+      i++;
+      continue;
+    } else if (argv[i][1] == 's') {
+      strip_rows = std::stoi(argv[++i]);
+      i++;
+      continue;
+    } else if (argv[i][1] == 't') {
+      telemetry = true;
+      i++;
+      continue;
+    } else if (argv[i][1] == 'w') {
+      if (std::sscanf(argv[++i], "%d,%d,%d,%d", &roi.x, &roi.y, &roi.width,
+                      &roi.height) != 4) {
+        std::cerr << "Invalid region of interest '" << argv[i]
+                  << "', expected x,y,w,h" << std::endl;
+        return 1;
+      }
+      i++;
+      continue;
     } else {
       std::cerr << "Invalid flag '" << argv[i][1] << "'" << std::endl;
       return 1;
@@ -105,8 +415,9 @@ int main(int argc, char *argv[]) {
 
   if (argc - i < 4) {
     std::cerr << "Usage: " << argv[0]
-              << " [-c comp -g gain (optional)] dir_path out_img raw_img1 "
-                 "raw_img2 [...]"
+              << " [-c comp -e -g gain -l -m mib -p -r -s rows -t "
+                 "-w x,y,w,h (optional)] dir_path out_img raw_img1 raw_img2 "
+                 "[...]"
               << std::endl;
     return 1;
   }
@@ -119,9 +430,99 @@ int main(int argc, char *argv[]) {
     in_names.emplace_back(argv[i++]);
   }
 
+  // a .tif or .tiff out_img is written at 16 bits, display-referred or, with
+  // -l, linear
+
+  const bool tiff = is_tiff(out_name);
+  if (linear && !tiff) {
+    std::cerr << "-l requires a .tif or .tiff out_img" << std::endl;
+    return 1;
+  }
+  if (tiff && (preview || telemetry)) {
+    std::cerr << "TIFF output cannot be combined with -p or -t" << std::endl;
+    return 1;
+  }
+  const OutputFormat format = !tiff   ? OutputFormat::U8
+                              : linear ? OutputFormat::U16Linear
+                                       : OutputFormat::U16;
+
+  // out-of-core mode: the burst is spilled to disk and rendered and written
+  // strip_rows rows at a time, or in the tallest strips whose working set
+  // fits in strip_budget_mib MiB
+
+  if (strip_rows > 0 || strip_budget_mib > 0) {
+    if (strip_rows > 0 && strip_budget_mib > 0) {
+      std::cerr << "-s and -m cannot be combined" << std::endl;
+      return 1;
+    }
+    if (linear || preview || sharpest_reference || telemetry ||
+        roi.width > 0) {
+      std::cerr << "-s and -m cannot be combined with -l, -p, -r, -t or -w"
+                << std::endl;
+      return 1;
+    }
+    StripRenderer renderer(dir_path, in_names);
+    const int halo = renderer.GetHaloRows();
+    if (strip_budget_mib > 0) {
+      strip_rows =
+          renderer.StripHeightForBudget(size_t(strip_budget_mib) << 20);
+      if (strip_rows == 0) {
+        std::cerr << "-m needs at least "
+                  << (renderer.StripWorkingSetBytes(halo) >> 20) + 1
+                  << " MiB for strips of " << halo << " rows" << std::endl;
+        return 1;
+      }
+    } else if (strip_rows < renderer.GetHeight() && strip_rows < halo) {
+      std::cerr << "-s needs at least " << halo
+                << " rows, the halo that each strip recomputes" << std::endl;
+      return 1;
+    }
+    std::cerr << "Strips: " << strip_rows << " rows, "
+              << (renderer.StripInputBytes(strip_rows) >> 20)
+              << " MiB of input and at most "
+              << (renderer.StripWorkingSetBytes(strip_rows) >> 20)
+              << " MiB in all each (halo " << halo << " rows)" << std::endl;
+    const StripRenderer::Options options{
+        .c = c,
+        .g = g,
+        .chroma_denoise = enhance,
+        .sharpen = enhance,
+        .sharpen_strength = HDRPlus::sharpen_strength,
+        .multi_pass_tone_map = true,
+        .contrast_strength = HDRPlus::contrast_strength};
+    if (tiff) {
+      TiffRowWriter writer(dir_path + "/" + out_name, renderer.GetWidth(),
+                           renderer.GetHeight());
+      renderer.Render16(strip_rows, options,
+                        [&](const Halide::Runtime::Buffer<uint16_t> &strip) {
+                          writer.write_rows(strip);
+                        });
+      writer.finish();
+      return 0;
+    }
+    PngRowWriter writer(dir_path + "/" + out_name, renderer.GetWidth(),
+                        renderer.GetHeight());
+    renderer.Render(strip_rows, options,
+                    [&](const Halide::Runtime::Buffer<uint8_t> &strip) {
+                      writer.write_rows(strip);
+                    });
+    writer.finish();
+    return 0;
+  }
+
   Burst burst(dir_path, in_names);
 
-  HDRPlus hdr_plus(burst, c, g);
+  HDRPlus hdr_plus(burst, c, g, telemetry, sharpest_reference, preview, roi,
+                   format, enhance);
+
+  if (tiff) {
+    Halide::Runtime::Buffer<uint16_t> output =
+        hdr_plus.process<uint16_t>();
+    if (!HDRPlus::save_tiff(dir_path, out_name, output)) {
+      return EXIT_FAILURE;
+    }
+    return 0;
+  }
 
   Halide::Runtime::Buffer<uint8_t> output = hdr_plus.process();
 
@@ -0,0 +1,1746 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <Halide.h>
+
+#include "src/AlignmentTelemetry.h"
+#include "src/Burst.h"
+#include "src/Point.h"
+#include "src/StripRenderer.h"
+#include "src/align.h"
+#include "src/finish.h"
+#include "src/merge.h"
+#include "src/util.h"
+
+using namespace Halide;
+using namespace Halide::ConciseCasts;
+
+namespace {
+
+struct Shift {
+  int x, y;
+};
+
+/*
+ * time_ms -- Returns the best wall time in milliseconds of several runs of f.
+ */
+double time_ms(const std::function<void()> &f, int iterations = 5) {
+  double best = 1e30;
+  for (int i = 0; i < iterations; i++) {
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const auto end = std::chrono::steady_clock::now();
+    best = std::min(
+        best, std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  return best;
+}
+
+/*
+ * synthetic_burst -- Builds a burst of noisy frames of a smooth random texture,
+ * each displaced by an (even) random walk. shifts[n] receives the displacement
+ * of frame n relative to frame 0. The texture and shifts do not depend on
+ * noise_sigma, so a burst with noise_sigma = 0 is the clean version of one
+ * with noise.
+ */
+Buffer<uint16_t> synthetic_burst(int width, int height, int frames,
+                                 std::vector<Shift> &shifts,
+                                 float noise_sigma = 200.f) {
+  std::mt19937 rng(1234);
+  std::uniform_int_distribution<int> value(4000, 60000);
+  std::uniform_int_distribution<int> step(-3, 3);
+  std::normal_distribution<float> noise(0.f, std::max(noise_sigma, 1e-3f));
+
+  const int margin = 128;
+  const int cell = 6;
+  const int tex_w = width + 2 * margin;
+  const int tex_h = height + 2 * margin;
+
+  // bilinearly interpolated random grid
+
+  Buffer<uint16_t> grid(tex_w / cell + 2, tex_h / cell + 2);
+  grid.for_each_value([&](uint16_t &v) { v = value(rng); });
+
+  Buffer<uint16_t> texture(tex_w, tex_h);
+  texture.for_each_element([&](int x, int y) {
+    const int gx = x / cell, gy = y / cell;
+    const float fx = float(x % cell) / cell, fy = float(y % cell) / cell;
+    const float top = grid(gx, gy) * (1 - fx) + grid(gx + 1, gy) * fx;
+    const float bot = grid(gx, gy + 1) * (1 - fx) + grid(gx + 1, gy + 1) * fx;
+    texture(x, y) = uint16_t(top * (1 - fy) + bot * fy);
+  });
+
+  shifts.assign(frames, {0, 0});
+  for (int n = 1; n < frames; n++) {
+    shifts[n].x = std::clamp(shifts[n - 1].x + 2 * step(rng), -margin, margin);
+    shifts[n].y = std::clamp(shifts[n - 1].y + 2 * step(rng), -margin, margin);
+  }
+
+  Buffer<uint16_t> burst(width, height, frames);
+  burst.for_each_element([&](int x, int y, int n) {
+    const float v = texture(x + margin + shifts[n].x, y + margin + shifts[n].y) +
+                    (noise_sigma > 0 ? noise(rng) : 0.f);
+    burst(x, y, n) = uint16_t(std::clamp(v, 0.f, 65535.f));
+  });
+  return burst;
+}
+
+/*
+ * noise_image -- Builds frames of uniform full-range noise; the worst case
+ * for most filters.
+ */
+Buffer<uint16_t> noise_image(int width, int height, int frames = 1) {
+  std::mt19937 rng(4321);
+  std::uniform_int_distribution<int> value(0, 65535);
+  Buffer<uint16_t> image(width, height, frames);
+  image.for_each_value([&](uint16_t &v) { v = value(rng); });
+  return image;
+}
+
+/*
+ * Deviation -- maximum and mean absolute difference between two buffers of
+ * the same shape.
+ */
+struct Deviation {
+  double max = 0, mean = 0;
+};
+
+template <typename T>
+Deviation deviation(const Buffer<T> &a, const Buffer<T> &b) {
+  Deviation d;
+  size_t count = 0;
+  a.for_each_element([&](const int *pos) {
+    const double diff = std::abs(double(a(pos)) - double(b(pos)));
+    d.max = std::max(d.max, diff);
+    d.mean += diff;
+    count++;
+  });
+  d.mean /= std::max<size_t>(1, count);
+  return d;
+}
+
+/*
+ * load_burst -- Loads a real burst from "dir raw1 raw2 ..." arguments.
+ */
+Buffer<uint16_t> load_burst(const std::vector<std::string> &args) {
+  std::vector<std::string> names(args.begin() + 1, args.end());
+  Burst burst(args[0], names);
+  return Buffer<uint16_t>(burst.ToBuffer());
+}
+
+/*
+ * align_seeded -- Compares the full-search alignment with the seeded
+ * alignment (each frame seeded by the previous frame's offsets) for wall time
+ * and accuracy. Accuracy is measured against the true displacement on a
+ * synthetic burst, and against the full search on a real burst when one is
+ * given as "dir raw1 raw2 ...".
+ */
+int bench_align_seeded(const std::vector<std::string> &args) {
+  const bool synthetic = args.size() < 3;
+  std::vector<Shift> shifts;
+  Buffer<uint16_t> burst = synthetic ? synthetic_burst(2048, 1536, 8, shifts)
+                                     : load_burst(args);
+
+  const int frames = burst.dim(2).extent();
+  const int num_tx = burst.width() / T_SIZE_2 - 1;
+  const int num_ty = burst.height() / T_SIZE_2 - 1;
+
+  // full search over the whole burst
+
+  Func full = align(burst);
+  full.compile_jit();
+  Realization full_result = full.realize({num_tx, num_ty, frames});
+  const double full_ms = time_ms([&]() { full.realize(full_result); });
+
+  // seeded search, one alternate frame at a time
+
+  Var x, y, n, tx, ty, c;
+  ImageParam reference(UInt(16), 2), alternate(UInt(16), 2), seed(Int(16), 3);
+  Param<int> search_radius;
+
+  Func imgs;
+  imgs(x, y, n) = mux(n, {reference(x, y), alternate(x, y)});
+  Func seed_clamped = BoundaryConditions::repeat_edge(seed);
+  Func seed_offsets;
+  seed_offsets(tx, ty, n) =
+      Tuple(seed_clamped(tx, ty, 0), seed_clamped(tx, ty, 1));
+  Func seeded = align_seeded(imgs, reference.width(), reference.height(),
+                             seed_offsets, search_radius);
+  Func seeded_out;
+  Point offset = P(seeded(tx, ty, 1));
+  seeded_out(tx, ty, c) = mux(c, {offset.x, offset.y});
+  seeded_out.bound(c, 0, 2).reorder(c, tx, ty).unroll(c).parallel(ty);
+  seeded_out.compile_jit();
+
+  // the first alternate frame has no seed and gets the full search
+
+  Func first = align(imgs, reference.width(), reference.height());
+  Func first_out;
+  Point first_offset = P(first(tx, ty, 1));
+  first_out(tx, ty, c) = mux(c, {first_offset.x, first_offset.y});
+  first_out.bound(c, 0, 2).reorder(c, tx, ty).unroll(c).parallel(ty);
+  first_out.compile_jit();
+
+  // error of an offset field relative to an expected offset per frame; tiles
+  // near the border are skipped as they see the mirrored boundary
+
+  auto mean_error = [&](const std::function<int(int, int, int, int)> &got,
+                        const std::function<int(int, int, int, int)> &want) {
+    double total = 0;
+    int count = 0;
+    for (int f = 1; f < frames; f++) {
+      for (int j = 8; j < num_ty - 8; j++) {
+        for (int i = 8; i < num_tx - 8; i++) {
+          total += std::abs(got(i, j, f, 0) - want(i, j, f, 0)) +
+                   std::abs(got(i, j, f, 1) - want(i, j, f, 1));
+          count++;
+        }
+      }
+    }
+    return count ? total / (2 * count) : 0.0;
+  };
+
+  Buffer<int16_t> full_x = full_result[0], full_y = full_result[1];
+  auto full_offset = [&](int i, int j, int f, int k) -> int {
+    return k == 0 ? full_x(i, j, f) : full_y(i, j, f);
+  };
+  auto true_offset = [&](int i, int j, int f, int k) -> int {
+    return k == 0 ? -shifts[f].x : -shifts[f].y;
+  };
+
+  if (synthetic) {
+    std::cout << "full search: " << full_ms << " ms, mean error "
+              << mean_error(full_offset, true_offset) << " px" << std::endl;
+  } else {
+    std::cout << "full search: " << full_ms << " ms" << std::endl;
+  }
+
+  for (int radius : {1, 2, 3}) {
+    Buffer<int16_t> alignment(num_tx, num_ty, frames, 2);
+    auto run = [&]() {
+      alignment.fill(0);
+      for (int f = 1; f < frames; f++) {
+        reference.set(burst.sliced(2, 0));
+        alternate.set(burst.sliced(2, f));
+        Buffer<int16_t> out = alignment.sliced(2, f);
+        if (f == 1) {
+          first_out.realize(out);
+          continue;
+        }
+        seed.set(alignment.sliced(2, f - 1));
+        search_radius.set(radius);
+        seeded_out.realize(out);
+      }
+    };
+    const double seeded_ms = time_ms(run);
+    auto seeded_offset = [&](int i, int j, int f, int k) -> int {
+      return alignment(i, j, f, k);
+    };
+    std::cout << "seeded search (radius " << radius << "): " << seeded_ms
+              << " ms, mean error "
+              << mean_error(seeded_offset,
+                            synthetic ? std::function<int(int, int, int, int)>(
+                                            true_offset)
+                                      : full_offset)
+              << " px" << (synthetic ? "" : " vs full search") << std::endl;
+  }
+  return 0;
+}
+
+/*
+ * align_telemetry -- Prints the alignment telemetry of a synthetic burst, or
+ * of a real burst given as "dir raw1 raw2 ...". The pipeline is compiled with
+ * the Halide profiler, whose report at exit breaks the time down by pyramid
+ * level (layer_N_scores and layer_N_alignment).
+ */
+int bench_align_telemetry(const std::vector<std::string> &args) {
+  std::vector<Shift> shifts;
+  Buffer<uint16_t> burst = args.size() < 3
+                               ? synthetic_burst(2048, 1536, 8, shifts)
+                               : load_burst(args);
+
+  Func telemetry;
+  Func alignment = align(Func(burst), burst.width(), burst.height(),
+                         burst.dim(2).extent(), telemetry);
+
+  Target target = get_jit_target_from_environment().with_feature(
+      Target::Profile);
+  telemetry.compile_jit(target);
+
+  Buffer<uint32_t> result(TELEMETRY_BINS, 2 * TELEMETRY_LEVELS + 2);
+  const double ms = time_ms([&]() { telemetry.realize(result, target); });
+
+  PrintAlignmentTelemetry(*result.get(), ms, std::cout);
+  return 0;
+}
+
+/*
+ * gauss_down4_reference -- The former gauss_down4, a 25-tap RDom over a
+ * lookup table kernel normalized by 159, for comparison.
+ */
+Func gauss_down4_reference(Func input) {
+  Func output("gauss_down4_reference");
+  Buffer<uint32_t> k(5, 5);
+  k.translate({-2, -2});
+  const uint32_t taps[5][5] = {{2, 4, 5, 4, 2},
+                               {4, 9, 12, 9, 4},
+                               {5, 12, 15, 12, 5},
+                               {4, 9, 12, 9, 4},
+                               {2, 4, 5, 4, 2}};
+  k.for_each_element([&](int x, int y) { k(x, y) = taps[y + 2][x + 2]; });
+
+  Var x, y, n;
+  RDom r(-2, 5, -2, 5);
+  output(x, y, n) =
+      u16(sum(u32(input(4 * x + r.x, 4 * y + r.y, n) * k(r.x, r.y))) / 159);
+  output.compute_root().parallel(y).vectorize(x, 16);
+  return output;
+}
+
+/*
+ * gauss_down4_worst_case -- Full scale wherever the separable gauss_down4
+ * kernel outweighs the former 25-tap kernel and zero elsewhere, tiled with the
+ * stride 4 of the downsample, so every output sits at the documented bound.
+ */
+Buffer<uint16_t> gauss_down4_worst_case(int width, int height) {
+  Buffer<uint16_t> image(width, height, 1);
+  image.for_each_element([&](int x, int y, int n) {
+    const int dx = (x + 2) % 4 - 2, dy = (y + 2) % 4 - 2;
+    const bool heavier = (dx + dy) % 2 == 0 && !(dx == -2 && dy == -2);
+    image(x, y, n) = heavier ? 65535 : 0;
+  });
+  return image;
+}
+
+/*
+ * gauss_down4 -- Time and deviation of the separable integer gauss_down4
+ * against the former 25-tap kernel, on a smooth texture, on noise and on the
+ * worst case pattern. Fails if the deviation exceeds the bound in util.h.
+ */
+int bench_gauss_down4(const std::vector<std::string> &args) {
+  std::vector<Shift> shifts;
+  const int width = 4096, height = 3072;
+  const double bound = 661;
+  const std::vector<std::pair<std::string, Buffer<uint16_t>>> images = {
+      {"texture", synthetic_burst(width, height, 1, shifts)},
+      {"noise", noise_image(width, height)},
+      {"worst case", gauss_down4_worst_case(width, height)}};
+
+  for (const auto &image : images) {
+    Func input = BoundaryConditions::mirror_interior(image.second);
+
+    Func reference = gauss_down4_reference(input);
+    Func separable = gauss_down4(input, "gauss_down4_separable");
+    reference.compile_jit();
+    separable.compile_jit();
+
+    Buffer<uint16_t> expected(width / 4, height / 4, 1);
+    Buffer<uint16_t> actual(width / 4, height / 4, 1);
+    const double reference_ms =
+        time_ms([&]() { reference.realize(expected); }, 20);
+    const double separable_ms =
+        time_ms([&]() { separable.realize(actual); }, 20);
+    const Deviation d = deviation(expected, actual);
+
+    std::cout << image.first << ": 25-tap " << reference_ms
+              << " ms, separable " << separable_ms << " ms, max deviation "
+              << d.max << " (bound " << bound << "), mean deviation "
+              << d.mean << std::endl;
+    if (d.max > bound) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * merge_fixed_point -- Time of the float and fixed-point merges on the same
+ * alignment, and the deviation of the fixed-point result. Fails if the
+ * deviation exceeds the bound documented for merge_temporal_fixed, taking the
+ * value range of the burst as the spread, plus 1 LSB for the truncation in
+ * merge_spatial.
+ */
+int bench_merge_fixed_point(const std::vector<std::string> &args) {
+  std::vector<Shift> shifts;
+  Buffer<uint16_t> burst = args.size() < 3
+                               ? synthetic_burst(4096, 3072, 8, shifts)
+                               : load_burst(args);
+
+  const int frames = burst.dim(2).extent();
+  const int num_tx = burst.width() / T_SIZE_2 - 1;
+  const int num_ty = burst.height() / T_SIZE_2 - 1;
+
+  Func alignment_func = align(burst);
+  Realization alignment = alignment_func.realize({num_tx, num_ty, frames});
+  Buffer<int16_t> offset_x = alignment[0], offset_y = alignment[1];
+
+  Var tx, ty, n;
+  Func offsets("offsets");
+  offsets(tx, ty, n) =
+      Tuple(BoundaryConditions::repeat_edge(offset_x)(tx, ty, n),
+            BoundaryConditions::repeat_edge(offset_y)(tx, ty, n));
+
+  Func merged_float = merge(burst, offsets);
+  Func merged_fixed = merge(burst, offsets, true);
+  merged_float.compile_jit();
+  merged_fixed.compile_jit();
+
+  Buffer<uint16_t> expected(burst.width(), burst.height());
+  Buffer<uint16_t> actual(burst.width(), burst.height());
+  const double float_ms = time_ms([&]() { merged_float.realize(expected); });
+  const double fixed_ms = time_ms([&]() { merged_fixed.realize(actual); });
+
+  int lo = 65535, hi = 0;
+  burst.for_each_value([&](uint16_t v) {
+    lo = std::min<int>(lo, v);
+    hi = std::max<int>(hi, v);
+  });
+  const double bound =
+      1 + frames / 2.0 + 2.0 * (frames - 1) * (hi - lo) / 32768;
+  const Deviation d = deviation(expected, actual);
+
+  std::cout << "float merge: " << float_ms << " ms, fixed-point merge: "
+            << fixed_ms << " ms" << std::endl
+            << "max deviation " << d.max << " (bound " << bound
+            << "), mean deviation " << d.mean << std::endl;
+  return d.max <= bound ? 0 : 1;
+}
+
+/*
+ * sharpness -- Cost of scoring the frames for reference selection, next to the
+ * cost of aligning the burst. On a synthetic burst, frame 0 is blurred with a
+ * 9x9 box filter and the benchmark fails unless another frame is selected.
+ */
+int bench_sharpness(const std::vector<std::string> &args) {
+  const bool synthetic = args.size() < 3;
+  std::vector<Shift> shifts;
+  Buffer<uint16_t> burst = synthetic ? synthetic_burst(4096, 3072, 8, shifts)
+                                     : load_burst(args);
+  const int frames = burst.dim(2).extent();
+
+  if (synthetic) {
+    Buffer<uint16_t> sharp = burst.sliced(2, 0).copy();
+    Func sharp_mirror = BoundaryConditions::mirror_interior(sharp);
+    Func blurred;
+    Var x, y;
+    RDom r(-4, 9, -4, 9);
+    blurred(x, y) = u16(sum(u32(sharp_mirror(x + r.x, y + r.y))) / 81);
+    Buffer<uint16_t> frame_0 = burst.sliced(2, 0);
+    blurred.realize(frame_0);
+  }
+
+  Func scores = sharpness(Func(burst), burst.width(), burst.height(), frames);
+  scores.compile_jit();
+  Buffer<float> result(frames);
+  const double scoring_ms = time_ms([&]() { scores.realize(result); });
+
+  Func alignment = align(burst);
+  alignment.compile_jit();
+  Realization offsets =
+      alignment.realize({burst.width() / T_SIZE_2 - 1,
+                         burst.height() / T_SIZE_2 - 1, frames});
+  const double align_ms = time_ms([&]() { alignment.realize(offsets); });
+
+  int reference = 0;
+  for (int n = 0; n < frames; n++) {
+    std::cout << "frame " << n << ": " << result(n) << std::endl;
+    if (result(n) > result(reference)) {
+      reference = n;
+    }
+  }
+  std::cout << "reference frame " << reference << ", scoring " << scoring_ms
+            << " ms, alignment " << align_ms << " ms" << std::endl;
+  return synthetic && reference == 0 ? 1 : 0;
+}
+
+/*
+ * rms_error -- root mean square difference between two buffers of the same
+ * shape.
+ */
+template <typename T>
+double rms_error(const Buffer<T> &a, const Buffer<T> &b) {
+  double total = 0;
+  size_t count = 0;
+  a.for_each_element([&](const int *pos) {
+    const double diff = double(a(pos)) - double(b(pos));
+    total += diff * diff;
+    count++;
+  });
+  return std::sqrt(total / std::max<size_t>(1, count));
+}
+
+/*
+ * merge_frequency -- Throughput of the frequency-domain merge against the
+ * spatial-domain merge, on the same alignment. On synthetic bursts the error
+ * of each merge against the noise-free reference frame is reported for two
+ * scene classes: a static scene, and one where a 512x512 block of every
+ * alternate frame is replaced by unrelated content (motion). A real burst can
+ * be given as "dir raw1 raw2 ...", for which only throughput is reported.
+ */
+int bench_merge_frequency(const std::vector<std::string> &args) {
+  const bool synthetic = args.size() < 3;
+  const int width = 4096, height = 3072, frames = 8;
+
+  std::vector<std::pair<std::string, Buffer<uint16_t>>> scenes;
+  Buffer<uint16_t> clean;
+  if (synthetic) {
+    std::vector<Shift> shifts;
+    clean = synthetic_burst(width, height, 1, shifts, 0.f).sliced(2, 0);
+    Buffer<uint16_t> still = synthetic_burst(width, height, frames, shifts);
+    Buffer<uint16_t> motion = still.copy();
+    Buffer<uint16_t> noise = noise_image(512, 512, frames);
+    for (int n = 1; n < frames; n++) {
+      for (int y = 0; y < 512; y++) {
+        for (int x = 0; x < 512; x++) {
+          motion(1024 + x, 1024 + y, n) = noise(x, y, n);
+        }
+      }
+    }
+    scenes = {{"static", still}, {"motion", motion}};
+  } else {
+    scenes = {{"burst", load_burst(args)}};
+  }
+
+  for (auto &scene : scenes) {
+    Buffer<uint16_t> &burst = scene.second;
+    const int num_tx = burst.width() / T_SIZE_2 - 1;
+    const int num_ty = burst.height() / T_SIZE_2 - 1;
+    const int num_frames = burst.dim(2).extent();
+
+    Func alignment_func = align(burst);
+    Realization alignment =
+        alignment_func.realize({num_tx, num_ty, num_frames});
+    Buffer<int16_t> offset_x = alignment[0], offset_y = alignment[1];
+
+    Var tx, ty, n;
+    Func offsets("offsets");
+    offsets(tx, ty, n) =
+        Tuple(BoundaryConditions::repeat_edge(offset_x)(tx, ty, n),
+              BoundaryConditions::repeat_edge(offset_y)(tx, ty, n));
+
+    Func spatial = merge(burst, offsets);
+    Func frequency = merge_frequency(Func(burst), burst.width(),
+                                     burst.height(), num_frames, offsets);
+    spatial.compile_jit();
+    frequency.compile_jit();
+
+    Buffer<uint16_t> spatial_out(burst.width(), burst.height());
+    Buffer<uint16_t> frequency_out(burst.width(), burst.height());
+    const double spatial_ms = time_ms([&]() { spatial.realize(spatial_out); });
+    const double frequency_ms =
+        time_ms([&]() { frequency.realize(frequency_out); });
+
+    const double mpix = double(burst.width()) * burst.height() * num_frames /
+                        1e6;
+    std::cout << scene.first << ": merge_temporal " << spatial_ms << " ms ("
+              << mpix / spatial_ms * 1000 << " Mpix/s), frequency "
+              << frequency_ms << " ms (" << mpix / frequency_ms * 1000
+              << " Mpix/s)" << std::endl;
+    if (synthetic) {
+      std::cout << "  rms error vs clean: merge_temporal "
+                << rms_error(clean, spatial_out) << ", frequency "
+                << rms_error(clean, frequency_out) << ", reference frame "
+                << rms_error(clean, Buffer<uint16_t>(burst.sliced(2, 0)))
+                << std::endl;
+    }
+  }
+  return 0;
+}
+
+/*
+ * merge_sparse -- Merge time as a growing share of every alternate frame is
+ * replaced by unrelated content, so that its tiles are rejected. The merge
+ * only reads the tiles of contributing frames, so the time should fall with
+ * the share of rejected tiles.
+ */
+int bench_merge_sparse(const std::vector<std::string> &args) {
+  const int width = 4096, height = 3072, frames = 8;
+  std::vector<Shift> shifts;
+  Buffer<uint16_t> still = synthetic_burst(width, height, frames, shifts);
+  Buffer<uint16_t> noise = noise_image(width, height, frames);
+
+  for (int percent : {0, 25, 50, 75, 100}) {
+    Buffer<uint16_t> burst = still.copy();
+    const int moving_width = width * percent / 100;
+    for (int n = 1; n < frames; n++) {
+      for (int y = 0; y < height; y++) {
+        for (int x = 0; x < moving_width; x++) {
+          burst(x, y, n) = noise(x, y, n);
+        }
+      }
+    }
+
+    Func alignment_func = align(burst);
+    Realization alignment = alignment_func.realize(
+        {width / T_SIZE_2 - 1, height / T_SIZE_2 - 1, frames});
+    Buffer<int16_t> offset_x = alignment[0], offset_y = alignment[1];
+
+    Var tx, ty, n;
+    Func offsets("offsets");
+    offsets(tx, ty, n) =
+        Tuple(BoundaryConditions::repeat_edge(offset_x)(tx, ty, n),
+              BoundaryConditions::repeat_edge(offset_y)(tx, ty, n));
+
+    Func merged_float = merge(burst, offsets);
+    Func merged_fixed = merge(burst, offsets, true);
+    merged_float.compile_jit();
+    merged_fixed.compile_jit();
+
+    Buffer<uint16_t> output(width, height);
+    const double float_ms = time_ms([&]() { merged_float.realize(output); });
+    const double fixed_ms = time_ms([&]() { merged_fixed.realize(output); });
+
+    std::cout << percent << "% moving: merge " << float_ms
+              << " ms, fixed-point merge " << fixed_ms << " ms" << std::endl;
+  }
+  return 0;
+}
+
+/*
+ * merge_spatial_reference -- The former float merge_spatial, for comparison.
+ */
+Func merge_spatial_reference(Func input) {
+  Func weight("raised_cosine_weights_reference");
+  Func output("merge_spatial_reference");
+  Var v, x, y;
+
+  float pi = 3.141592f;
+  weight(v) = 0.5f - 0.5f * cos(2 * pi * (v + 0.5f) / T_SIZE);
+
+  Expr weight_00 = weight(idx_0(x)) * weight(idx_0(y));
+  Expr weight_10 = weight(idx_1(x)) * weight(idx_0(y));
+  Expr weight_01 = weight(idx_0(x)) * weight(idx_1(y));
+  Expr weight_11 = weight(idx_1(x)) * weight(idx_1(y));
+
+  Expr val_00 = input(idx_0(x), idx_0(y), tile_0(x), tile_0(y));
+  Expr val_10 = input(idx_1(x), idx_0(y), tile_1(x), tile_0(y));
+  Expr val_01 = input(idx_0(x), idx_1(y), tile_0(x), tile_1(y));
+  Expr val_11 = input(idx_1(x), idx_1(y), tile_1(x), tile_1(y));
+
+  output(x, y) = u16(weight_00 * val_00 + weight_10 * val_10 +
+                     weight_01 * val_01 + weight_11 * val_11);
+
+  weight.compute_root().vectorize(v, 32);
+  output.compute_root().parallel(y).vectorize(x, 32);
+  return output;
+}
+
+/*
+ * merge_spatial -- Time and deviation of the fixed-point, table-driven
+ * merge_spatial against the former float blend. The tiles are cut from a
+ * synthetic frame, with independent noise in each tile so that overlapping
+ * tiles disagree as they do after a temporal merge. Fails if any pixel is
+ * more than 1 LSB away.
+ */
+int bench_merge_spatial(const std::vector<std::string> &args) {
+  const int width = 4096, height = 3072;
+  std::vector<Shift> shifts;
+  Buffer<uint16_t> image =
+      synthetic_burst(width, height, 1, shifts).sliced(2, 0);
+
+  const int num_tx = width / T_SIZE_2 + 1;
+  const int num_ty = height / T_SIZE_2 + 1;
+  std::mt19937 rng(99);
+  std::normal_distribution<float> noise(0.f, 50.f);
+  Buffer<float> tiles(T_SIZE, T_SIZE, num_tx, num_ty);
+  tiles.translate({0, 0, -1, -1});
+  tiles.for_each_element([&](int ix, int iy, int tx, int ty) {
+    const int x = std::clamp(tx * T_SIZE_2 + ix, 0, width - 1);
+    const int y = std::clamp(ty * T_SIZE_2 + iy, 0, height - 1);
+    tiles(ix, iy, tx, ty) =
+        std::clamp(image(x, y) + noise(rng), 0.f, 65535.f);
+  });
+
+  Func reference = merge_spatial_reference(Func(tiles));
+  Func fixed_point = merge_spatial(Func(tiles));
+  reference.compile_jit();
+  fixed_point.compile_jit();
+
+  Buffer<uint16_t> expected(width, height), actual(width, height);
+  const double reference_ms =
+      time_ms([&]() { reference.realize(expected); }, 20);
+  const double fixed_ms = time_ms([&]() { fixed_point.realize(actual); }, 20);
+  const Deviation d = deviation(expected, actual);
+
+  std::cout << "float blend " << reference_ms << " ms, fixed-point blend "
+            << fixed_ms << " ms, max deviation " << d.max
+            << ", mean deviation " << d.mean << std::endl;
+  return d.max <= 1 ? 0 : 1;
+}
+
+/*
+ * merge_long_burst -- Merge time per frame around the burst length from which
+ * the frame reduction is split into parallel groups (32), on a small frame
+ * where rows of tiles alone give little parallelism.
+ */
+int bench_merge_long_burst(const std::vector<std::string> &args) {
+  const int width = 1024, height = 768;
+  std::vector<Shift> shifts;
+  Buffer<uint16_t> long_burst = synthetic_burst(width, height, 64, shifts);
+
+  for (int frames : {16, 31, 32, 48, 64}) {
+    Buffer<uint16_t> burst = long_burst.cropped(2, 0, frames);
+
+    Func alignment_func = align(burst);
+    Realization alignment = alignment_func.realize(
+        {width / T_SIZE_2 - 1, height / T_SIZE_2 - 1, frames});
+    Buffer<int16_t> offset_x = alignment[0], offset_y = alignment[1];
+
+    Var tx, ty, n;
+    Func offsets("offsets");
+    offsets(tx, ty, n) =
+        Tuple(BoundaryConditions::repeat_edge(offset_x)(tx, ty, n),
+              BoundaryConditions::repeat_edge(offset_y)(tx, ty, n));
+
+    Func merged = merge(burst, offsets);
+    merged.compile_jit();
+
+    Buffer<uint16_t> output(width, height);
+    const double ms = time_ms([&]() { merged.realize(output); });
+    std::cout << frames << " frames: " << ms << " ms, " << ms / frames
+              << " ms per frame" << std::endl;
+  }
+  return 0;
+}
+
+/*
+ * demosaic_reference -- The former demosaic: four full-resolution 5x5
+ * convolutions computed at root, one selected per site and channel.
+ */
+Func demosaic_reference(Func input, Expr width, Expr height) {
+  const int taps[4][5][5] = {{{0, 0, -1, 0, 0},
+                              {0, 0, 2, 0, 0},
+                              {-1, 2, 4, 2, -1},
+                              {0, 0, 2, 0, 0},
+                              {0, 0, -1, 0, 0}},
+                             {{0, 0, 1, 0, 0},
+                              {0, -2, 0, -2, 0},
+                              {-2, 8, 10, 8, -2},
+                              {0, -2, 0, -2, 0},
+                              {0, 0, 1, 0, 0}},
+                             {{0, 0, -2, 0, 0},
+                              {0, -2, 8, -2, 0},
+                              {1, 0, 10, 0, 1},
+                              {0, -2, 8, -2, 0},
+                              {0, 0, -2, 0, 0}},
+                             {{0, 0, -3, 0, 0},
+                              {0, 4, 0, 4, 0},
+                              {-3, 0, 12, 0, -3},
+                              {0, 4, 0, 4, 0},
+                              {0, 0, -3, 0, 0}}};
+  const int sums[4] = {8, 16, 16, 16};
+
+  Var x, y, c;
+  RDom r(-2, 5, -2, 5);
+  Func input_mirror = BoundaryConditions::mirror_interior(
+      input, {Range(0, width), Range(0, height)});
+
+  std::vector<Func> d;
+  for (int k = 0; k < 4; k++) {
+    Buffer<int32_t> f(5, 5);
+    f.translate({-2, -2});
+    f.for_each_element([&](int i, int j) { f(i, j) = taps[k][j + 2][i + 2]; });
+    Func dk("demosaic_reference_" + std::to_string(k));
+    dk(x, y) = u16_sat(sum(i32(input_mirror(x + r.x, y + r.y)) * f(r.x, r.y)) /
+                       sums[k]);
+    dk.compute_root().parallel(y).vectorize(x, 16);
+    d.push_back(dk);
+  }
+
+  Expr R_row = y % 2 == 0, B_row = !R_row;
+  Expr R_col = x % 2 == 0, B_col = !R_col;
+  Expr at_R = c == 0, at_G = c == 1, at_B = c == 2;
+
+  Func output("demosaic_reference");
+  output(x, y, c) = select(
+      at_R && R_row && B_col, d[1](x, y), at_R && B_row && R_col, d[2](x, y),
+      at_R && B_row && B_col, d[3](x, y), at_G && R_row && R_col, d[0](x, y),
+      at_G && B_row && B_col, d[0](x, y), at_B && B_row && R_col, d[1](x, y),
+      at_B && R_row && B_col, d[2](x, y), at_B && R_row && R_col, d[3](x, y),
+      input(x, y));
+  output.compute_root()
+      .parallel(y)
+      .align_bounds(x, 2)
+      .unroll(x, 2)
+      .align_bounds(y, 2)
+      .unroll(y, 2)
+      .vectorize(x, 16);
+  return output;
+}
+
+/*
+ * demosaic -- Time of the phase-aware demosaic against the former one, which
+ * computes all four filters everywhere. Fails unless the outputs are
+ * identical.
+ */
+int bench_demosaic(const std::vector<std::string> &args) {
+  const int width = 4096, height = 3072;
+  const std::vector<std::pair<std::string, Buffer<uint16_t>>> images = {
+      {"noise", noise_image(width, height)}};
+
+  for (const auto &image : images) {
+    Buffer<uint16_t> mosaic = image.second.sliced(2, 0);
+
+    Func reference = demosaic_reference(Func(mosaic), width, height);
+    Func phase_aware = demosaic(Func(mosaic), width, height);
+    reference.compile_jit();
+    phase_aware.compile_jit();
+
+    Buffer<uint16_t> expected(width, height, 3), actual(width, height, 3);
+    const double reference_ms =
+        time_ms([&]() { reference.realize(expected); }, 10);
+    const double phase_aware_ms =
+        time_ms([&]() { phase_aware.realize(actual); }, 10);
+    const Deviation d = deviation(expected, actual);
+
+    std::cout << image.first << ": four filters " << reference_ms
+              << " ms, phase-aware " << phase_aware_ms << " ms, max deviation "
+              << d.max << std::endl;
+    if (d.max != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * demosaic_modes -- Throughput and quality of each demosaic algorithm. The
+ * ground truth is a synthetic RGB image (three shifted copies of a smooth
+ * texture) which is mosaicked and demosaicked again; the error is measured
+ * away from the borders.
+ */
+int bench_demosaic_modes(const std::vector<std::string> &args) {
+  const int width = 4096, height = 3072;
+  std::vector<Shift> shifts;
+  Buffer<uint16_t> truth = synthetic_burst(width, height, 3, shifts, 0.f);
+
+  Buffer<uint16_t> mosaic(width, height);
+  mosaic.for_each_element([&](int x, int y) {
+    const int c = (x % 2) + (y % 2); // RG/GB
+    mosaic(x, y) = truth(x, y, c);
+  });
+
+  const std::vector<std::pair<std::string, DemosaicAlgorithm>> modes = {
+      {"malvar", DemosaicAlgorithm::Malvar},
+      {"bilinear", DemosaicAlgorithm::Bilinear}};
+
+  for (const auto &mode : modes) {
+    Func demosaicked = demosaic(Func(mosaic), width, height, mode.second);
+    demosaicked.compile_jit();
+
+    Buffer<uint16_t> output(width, height, 3);
+    const double ms = time_ms([&]() { demosaicked.realize(output); }, 10);
+    const double error = rms_error(truth.cropped({{2, width - 4},
+                                                  {2, height - 4},
+                                                  {0, 3}}),
+                                   output.cropped({{2, width - 4},
+                                                   {2, height - 4},
+                                                   {0, 3}}));
+
+    std::cout << mode.first << ": " << ms << " ms, "
+              << width * double(height) / (ms * 1000) << " Mpix/s, rms error "
+              << error << std::endl;
+  }
+  return 0;
+}
+
+/*
+ * gamma_pow_reference -- The former gamma_correct (inverse = false) and
+ * gamma_inverse (inverse = true), evaluating pow() per pixel.
+ */
+Func gamma_pow_reference(Func input, bool inverse) {
+  Func output(inverse ? "gamma_inverse_reference" : "gamma_correct_reference");
+  std::vector<Var> args(input.dimensions());
+  std::vector<Expr> vars(args.begin(), args.end());
+  Expr v = input(vars);
+  if (inverse) {
+    output(args) = u16(
+        select(v < 2575, 0.0774f * v,
+               pow(f32(v) / 65535.f + 0.055f, 2.4f) * 57632.49226f));
+  } else {
+    output(args) = u16(select(v < 200, 12.92f * v,
+                              680.552897f * pow(v, 0.416667f) - 3604.425f));
+  }
+  output.compute_root().parallel(args[1]).vectorize(args[0], 16);
+  return output;
+}
+
+/*
+ * gamma_lut -- Throughput of the table-driven gamma_correct and gamma_inverse
+ * against the former pow() versions, on a single channel image (the six
+ * calls inside tone_map) and a three channel one (the final gamma of
+ * finish). Fails if any output moves by more than 1.
+ */
+int bench_gamma_lut(const std::vector<std::string> &args) {
+  const int width = 4096, height = 3072;
+  const std::vector<std::pair<std::string, Buffer<uint16_t>>> images = {
+      {"gray", noise_image(width, height).sliced(2, 0)},
+      {"rgb", noise_image(width, height, 3)}};
+
+  for (const auto &image : images) {
+    for (bool inverse : {false, true}) {
+      Func reference = gamma_pow_reference(Func(image.second), inverse);
+      Func lut = inverse ? gamma_inverse(Func(image.second))
+                         : gamma_correct(Func(image.second));
+      reference.compile_jit();
+      lut.compile_jit();
+
+      std::vector<int> sizes;
+      for (int i = 0; i < image.second.dimensions(); i++) {
+        sizes.push_back(image.second.dim(i).extent());
+      }
+      Buffer<uint16_t> expected(sizes), actual(sizes);
+      const double pow_ms =
+          time_ms([&]() { reference.realize(expected); }, 10);
+      const double lut_ms = time_ms([&]() { lut.realize(actual); }, 10);
+      const Deviation d = deviation(expected, actual);
+
+      std::cout << image.first << " "
+                << (inverse ? "gamma_inverse" : "gamma_correct") << ": pow "
+                << pow_ms << " ms, table " << lut_ms << " ms, max deviation "
+                << d.max << std::endl;
+      if (d.max > 1) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+ * tone_curve -- Time of the fused gamma/contrast/8-bit tone curve against
+ * the three separate passes it replaces in finish. Fails unless the outputs
+ * are identical.
+ */
+int bench_tone_curve(const std::vector<std::string> &args) {
+  const int width = 4096, height = 3072;
+  const float strength = 5.f;
+  const int black_level = 2000;
+  Buffer<uint16_t> image = noise_image(width, height, 3);
+
+  Func chain = u8bit_interleaved(
+      contrast(gamma_correct(Func(image)), strength, black_level));
+  Func fused = tone_curve_interleaved(Func(image), strength, black_level);
+  chain.compile_jit();
+  fused.compile_jit();
+
+  Buffer<uint8_t> expected(3, width, height), actual(3, width, height);
+  const double chain_ms = time_ms([&]() { chain.realize(expected); }, 10);
+  const double fused_ms = time_ms([&]() { fused.realize(actual); }, 10);
+  const Deviation d = deviation(expected, actual);
+
+  std::cout << "three passes " << chain_ms << " ms, fused " << fused_ms
+            << " ms, max deviation " << d.max << std::endl;
+  return d.max == 0 ? 0 : 1;
+}
+
+/*
+ * tone_map_reduced -- Time of tone_map at full resolution and with the
+ * exposure fusion at 1/2, 1/4 and 1/8 resolution, and the error of each
+ * reduced mode against the full resolution output. The input is a synthetic
+ * RGB image (three shifted copies of a smooth texture).
+ */
+int bench_tone_map_reduced(const std::vector<std::string> &args) {
+  const int width = 4096, height = 3072;
+  const float comp = 3.8f, gain = 1.1f;
+  std::vector<Shift> shifts;
+  Buffer<uint16_t> image = synthetic_burst(width, height, 3, shifts, 0.f);
+
+  Buffer<uint16_t> full(width, height, 3);
+  for (int downsample : {1, 2, 4, 8}) {
+    Func tone_mapped =
+        tone_map(Func(image), width, height, comp, gain, downsample);
+    tone_mapped.compile_jit();
+
+    Buffer<uint16_t> output(width, height, 3);
+    const double ms = time_ms([&]() { tone_mapped.realize(output); }, 3);
+
+    std::cout << "1/" << downsample << ": " << ms << " ms";
+    if (downsample == 1) {
+      full.copy_from(output);
+    } else {
+      const Deviation d = deviation(full, output);
+      std::cout << ", rms error " << rms_error(full, output)
+                << ", mean deviation " << d.mean << ", max deviation "
+                << d.max;
+    }
+    std::cout << std::endl;
+  }
+  return 0;
+}
+
+/*
+ * bilateral_filter_reference -- The chroma bilateral filter as it was before
+ * bilateral_grid: a brute force 7x7 bilateral on each of U and V, using the
+ * difference in that channel for the range weight. Its (separable) spatial
+ * kernel is rebuilt from the 1-D gaussian it was the product of.
+ */
+Func bilateral_filter_reference(Func input, Expr width, Expr height) {
+  const float g[7] = {0.026268f, 0.10074f,  0.22551f, 0.29496f,
+                      0.22551f,  0.10074f,  0.026268f};
+  Buffer<float> k(7, 7);
+  k.translate({-3, -3});
+  k.for_each_element([&](int i, int j) { k(i, j) = g[i + 3] * g[j + 3]; });
+
+  Func weights, total_weights, bilateral, output("bilateral_reference");
+  Var x, y, dx, dy, c;
+  RDom r(-3, 7, -3, 7);
+
+  Func input_mirror = BoundaryConditions::mirror_interior(
+      input, {Range(0, width), Range(0, height)});
+
+  Expr neighbour = input_mirror(x + dx, y + dy, c);
+  Expr dist = f32(i32(input_mirror(x, y, c)) - i32(neighbour));
+  Expr score =
+      select(abs(neighbour) > 25000.f, 0.f, exp(-dist * dist / 100.f));
+
+  weights(dx, dy, x, y, c) = k(dx, dy) * score;
+  total_weights(x, y, c) = sum(weights(r.x, r.y, x, y, c));
+  bilateral(x, y, c) =
+      sum(input_mirror(x + r.x, y + r.y, c) * weights(r.x, r.y, x, y, c)) /
+      total_weights(x, y, c);
+
+  output(x, y, c) = f32(input(x, y, c));
+  output(x, y, 1) = bilateral(x, y, 1);
+  output(x, y, 2) = bilateral(x, y, 2);
+
+  weights.compute_at(output, y).vectorize(x, 16);
+  output.compute_root().parallel(y).vectorize(x, 16);
+  output.update(0).parallel(y).vectorize(x, 16);
+  output.update(1).parallel(y).vectorize(x, 16);
+  return output;
+}
+
+/*
+ * bilateral_grid -- Time and quality of the two first passes of
+ * chroma_denoise: bilateral_filter, the default, and bilateral_grid. The input
+ * is a synthetic RGB image (three shifted copies of a smooth texture) with
+ * gaussian noise of several strengths; quality is the RMS error of U and V
+ * against the clean image. The grid is not quality matched (see
+ * bilateral_grid), so only the default is held to the former filter: fails if
+ * bilateral_filter deviates from bilateral_filter_reference by more than 1,
+ * the float rounding of the two kernels.
+ */
+int bench_bilateral_grid(const std::vector<std::string> &args) {
+  const int width = 4096, height = 3072;
+  std::vector<Shift> shifts;
+  Buffer<uint16_t> clean = synthetic_burst(width, height, 3, shifts, 0.f);
+
+  Func clean_yuv = rgb_to_yuv(Func(clean));
+  Buffer<float> clean_out = clean_yuv.realize({width, height, 3});
+  Buffer<float> clean_uv = clean_out.cropped(2, 1, 2);
+
+  const double bound = 1;
+  int result = 0;
+  for (float sigma : {200.f, 800.f, 2000.f}) {
+    std::mt19937 rng(5678);
+    std::normal_distribution<float> noise(0.f, sigma);
+    Buffer<uint16_t> noisy(width, height, 3);
+    noisy.for_each_element([&](int x, int y, int c) {
+      noisy(x, y, c) =
+          uint16_t(std::clamp(clean(x, y, c) + noise(rng), 0.f, 65535.f));
+    });
+
+    Func yuv = rgb_to_yuv(Func(noisy));
+    Buffer<float> noisy_yuv = yuv.realize({width, height, 3});
+
+    Func reference = bilateral_filter_reference(Func(noisy_yuv), width, height);
+    Func filter = bilateral_filter(Func(noisy_yuv), width, height);
+    Func grid = bilateral_grid(Func(noisy_yuv), width, height);
+    reference.compile_jit();
+    filter.compile_jit();
+    grid.compile_jit();
+
+    Buffer<float> reference_out(width, height, 3), filter_out(width, height, 3);
+    Buffer<float> grid_out(width, height, 3);
+    reference.realize(reference_out);
+    const double filter_ms = time_ms([&]() { filter.realize(filter_out); }, 3);
+    const double grid_ms = time_ms([&]() { grid.realize(grid_out); }, 3);
+    const Deviation d = deviation(reference_out, filter_out);
+
+    std::cout << "sigma " << sigma << ": noisy rms "
+              << rms_error(clean_uv, noisy_yuv.cropped(2, 1, 2))
+              << "; 7x7 bilateral " << filter_ms << " ms, rms "
+              << rms_error(clean_uv, filter_out.cropped(2, 1, 2))
+              << ", max deviation from the former " << d.max << " (bound "
+              << bound << "); bilateral grid " << grid_ms << " ms, rms "
+              << rms_error(clean_uv, grid_out.cropped(2, 1, 2)) << std::endl;
+    if (d.max > bound) {
+      result = 1;
+    }
+  }
+  return result;
+}
+
+/*
+ * gauss_blurs -- One microbenchmark per gaussian blur call site:
+ *   combine: gauss_7x7 on u16, float against fixed point
+ *   sharpen: gauss_7x7 on f32 YUV against the recursive blur
+ *   desaturate_noise: two gauss_15x15 on f32 YUV against one recursive blur
+ * Prints the time of each and the max and RMS deviation from the former.
+ */
+int bench_gauss_blurs(const std::vector<std::string> &args) {
+  const int width = 4096, height = 3072;
+  std::vector<Shift> shifts;
+  Buffer<uint16_t> gray = synthetic_burst(width, height, 1, shifts, 200.f);
+  Buffer<uint16_t> rgb = synthetic_burst(width, height, 3, shifts, 200.f);
+  Buffer<float> yuv = rgb_to_yuv(Func(rgb)).realize({width, height, 3});
+
+  Func gray_clamped = BoundaryConditions::repeat_edge(gray.sliced(2, 0));
+  Func gray_f32("gray_f32");
+  Var x, y;
+  gray_f32(x, y) = f32(gray_clamped(x, y));
+  Func yuv_clamped = BoundaryConditions::repeat_edge(yuv);
+
+  struct Site {
+    std::string name;
+    Func before, after;
+  };
+  Func float_7x7("float_7x7");
+  float_7x7(x, y) = u16(gauss_7x7(gray_f32, "combine_float")(x, y));
+  const std::vector<Site> sites = {
+      {"combine", float_7x7, gauss_7x7(gray_clamped, "combine_fixed")},
+      {"sharpen", gauss_7x7(yuv_clamped, "sharpen_7x7"),
+       gauss_iir(yuv_clamped, 4.f / 3.f, width, height, "sharpen_iir")},
+      {"desaturate_noise",
+       gauss_15x15(gauss_15x15(yuv_clamped, "desaturate_15x15_1"),
+                   "desaturate_15x15_2"),
+       gauss_iir(yuv_clamped, 8.f / 3.f * std::sqrt(2.f), width, height,
+                 "desaturate_iir")}};
+
+  for (const Site &site : sites) {
+    Func before = site.before, after = site.after;
+    before.compile_jit();
+    after.compile_jit();
+
+    const bool planar = before.dimensions() == 3;
+    const Type type = before.types()[0];
+    std::vector<int> sizes = {width, height};
+    if (planar) {
+      sizes.push_back(3);
+    }
+
+    double before_ms, after_ms, rms;
+    Deviation d;
+    if (type == UInt(16)) {
+      Buffer<uint16_t> expected(sizes), actual(sizes);
+      before_ms = time_ms([&]() { before.realize(expected); });
+      after_ms = time_ms([&]() { after.realize(actual); });
+      d = deviation(expected, actual);
+      rms = rms_error(expected, actual);
+    } else {
+      Buffer<float> expected(sizes), actual(sizes);
+      before_ms = time_ms([&]() { before.realize(expected); });
+      after_ms = time_ms([&]() { after.realize(actual); });
+      d = deviation(expected, actual);
+      rms = rms_error(expected, actual);
+    }
+
+    std::cout << site.name << ": before " << before_ms << " ms, after "
+              << after_ms << " ms, max deviation " << d.max << ", rms " << rms
+              << std::endl;
+  }
+  return 0;
+}
+
+/*
+ * normalize_raw_reference -- The former raw normalization: CFA shift, black
+ * and white levels, then a zero-filled white balance buffer written by four
+ * strided updates, one per bayer site.
+ */
+Func normalize_raw_reference(Func input, Expr width, Expr height, Expr bp,
+                             Expr wp, const CompiletimeWhiteBalance &wb,
+                             Expr cfa_pattern) {
+  Func shifted, level, output("normalize_raw_reference");
+  Var x, y;
+  RDom r(0, width / 2, 0, height / 2);
+
+  shifted(x, y) =
+      select(cfa_pattern == int(CfaPattern::CFA_RGGB), input(x, y),
+             cfa_pattern == int(CfaPattern::CFA_GRBG), input(x + 1, y),
+             cfa_pattern == int(CfaPattern::CFA_GBRG), input(x, y + 1),
+             cfa_pattern == int(CfaPattern::CFA_BGGR), input(x + 1, y + 1), 0);
+  level(x, y) = u16_sat((i32(shifted(x, y)) - bp) * (65535.f / (wp - bp)));
+
+  output(x, y) = u16(0);
+  output(r.x * 2, r.y * 2) = u16_sat(wb.r * f32(level(r.x * 2, r.y * 2)));
+  output(r.x * 2 + 1, r.y * 2) =
+      u16_sat(wb.g0 * f32(level(r.x * 2 + 1, r.y * 2)));
+  output(r.x * 2, r.y * 2 + 1) =
+      u16_sat(wb.g1 * f32(level(r.x * 2, r.y * 2 + 1)));
+  output(r.x * 2 + 1, r.y * 2 + 1) =
+      u16_sat(wb.b * f32(level(r.x * 2 + 1, r.y * 2 + 1)));
+
+  output.compute_root().parallel(y).vectorize(x, 16);
+  for (int i = 0; i < 4; i++) {
+    output.update(i).parallel(r.y);
+  }
+  return output;
+}
+
+/*
+ * normalize_raw -- Time of the single pass raw normalization against the
+ * former five stages, for every CFA pattern. Fails unless the outputs are
+ * identical.
+ */
+int bench_normalize_raw(const std::vector<std::string> &args) {
+  const int width = 4095, height = 3071; // odd, to cover partial quads
+  Buffer<uint16_t> raw = noise_image(width + 1, height + 1).sliced(2, 0);
+  const CompiletimeWhiteBalance wb{2.1f, 1.f, 1.02f, 1.6f};
+
+  for (int cfa = int(CfaPattern::CFA_UNKNOWN);
+       cfa <= int(CfaPattern::CFA_GBRG); cfa++) {
+    Func reference = normalize_raw_reference(Func(raw), width, height, 1024,
+                                             60000, wb, cfa);
+    Func fused = normalize_raw(Func(raw), width, height, 1024, 60000, wb, cfa);
+    reference.compile_jit();
+    fused.compile_jit();
+
+    Buffer<uint16_t> expected(width, height), actual(width, height);
+    const double reference_ms =
+        time_ms([&]() { reference.realize(expected); }, 10);
+    const double fused_ms = time_ms([&]() { fused.realize(actual); }, 10);
+    const Deviation d = deviation(expected, actual);
+
+    std::cout << "cfa " << cfa << ": five stages " << reference_ms
+              << " ms, single pass " << fused_ms << " ms, max deviation "
+              << d.max << std::endl;
+    if (d.max != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * color_fold -- Time from the raw mosaic to linear sRGB with white balance
+ * before the demosaic and srgb() after it, against the folded path that
+ * applies a single 3x3 transform in the demosaic pass. The input is a
+ * synthetic RGB image, scaled by the inverse white balance and mosaicked.
+ * Prints the deviation between the two paths.
+ */
+int bench_color_fold(const std::vector<std::string> &args) {
+  const int width = 4096, height = 3072;
+  const float gains[4] = {2.1f, 1.f, 1.02f, 1.6f};
+  std::vector<Shift> shifts;
+  Buffer<uint16_t> truth = synthetic_burst(width, height, 3, shifts, 0.f);
+
+  Buffer<uint16_t> mosaic(width, height);
+  mosaic.for_each_element([&](int x, int y) {
+    const int site = (x % 2) + 2 * (y % 2); // R, G0, G1, B
+    const int c = (x % 2) + (y % 2);
+    mosaic(x, y) = uint16_t(truth(x, y, c) / gains[site]);
+  });
+
+  Buffer<float> ccm(3, 3);
+  const float dcraw[3][3] = {{1.964399f, -1.119710f, 0.155311f},
+                             {-0.241156f, 1.673722f, -0.432566f},
+                             {0.013887f, -0.549820f, 1.535933f}};
+  ccm.for_each_element([&](int r, int c) { ccm(r, c) = dcraw[c][r]; });
+
+  const CompiletimeWhiteBalance wb{gains[0], gains[1], gains[2], gains[3]};
+  const CompiletimeWhiteBalance greens{1.f, 1.f, gains[2] / gains[1], 1.f};
+  const int rggb = int(CfaPattern::CFA_RGGB);
+
+  Func separate = srgb(
+      demosaic(normalize_raw(Func(mosaic), width, height, 0, 65535, wb, rggb),
+               width, height),
+      Func(ccm));
+  separate.compute_root().parallel(separate.args()[1]).vectorize(
+      separate.args()[0], 16);
+
+  Var r, c;
+  Func folded_matrix("folded_matrix");
+  folded_matrix(r, c) =
+      ccm(r, c) * select(r == 0, wb.r, r == 1, wb.g0, wb.b);
+  folded_matrix.compute_root();
+  Func folded = demosaic(
+      normalize_raw(Func(mosaic), width, height, 0, 65535, greens, rggb),
+      width, height, DemosaicAlgorithm::Malvar, folded_matrix);
+
+  separate.compile_jit();
+  folded.compile_jit();
+
+  Buffer<uint16_t> expected(width, height, 3), actual(width, height, 3);
+  const double separate_ms =
+      time_ms([&]() { separate.realize(expected); }, 10);
+  const double folded_ms = time_ms([&]() { folded.realize(actual); }, 10);
+  const Deviation d = deviation(expected, actual);
+
+  std::cout << "separate " << separate_ms << " ms, folded " << folded_ms
+            << " ms, mean deviation " << d.mean << ", max deviation " << d.max
+            << std::endl;
+  return 0;
+}
+
+/*
+ * yuv_fixed_point -- Time of each YUV stage with f32 and with fixed-point i16
+ * intermediates, on a noisy synthetic RGB image, and the deviation of the
+ * fixed-point RGB output from the f32 one (see rgb_to_yuv for the budget).
+ */
+int bench_yuv_fixed_point(const std::vector<std::string> &args) {
+  const int width = 4096, height = 3072;
+  std::vector<Shift> shifts;
+  Buffer<uint16_t> rgb = synthetic_burst(width, height, 3, shifts, 800.f);
+
+  const std::vector<
+      std::pair<std::string, std::function<Func(Func, bool)>>>
+      stages = {
+          {"rgb_to_yuv + yuv_to_rgb",
+           [&](Func in, bool fixed) {
+             return yuv_to_rgb(rgb_to_yuv(in, fixed));
+           }},
+          {"bilateral_grid",
+           [&](Func in, bool fixed) {
+             return yuv_to_rgb(
+                 bilateral_grid(rgb_to_yuv(in, fixed), width, height));
+           }},
+          {"chroma_denoise (3 passes)",
+           [&](Func in, bool fixed) {
+             return chroma_denoise(in, width, height, 3, false, fixed);
+           }},
+          {"sharpen",
+           [&](Func in, bool fixed) {
+             return sharpen(BoundaryConditions::repeat_edge(
+                                in, {Range(0, width), Range(0, height)}),
+                            2.f, fixed);
+           }}};
+
+  for (const auto &stage : stages) {
+    Func f32_stage = stage.second(Func(rgb), false);
+    Func i16_stage = stage.second(Func(rgb), true);
+    f32_stage.compile_jit();
+    i16_stage.compile_jit();
+
+    Buffer<uint16_t> expected(width, height, 3), actual(width, height, 3);
+    const double f32_ms = time_ms([&]() { f32_stage.realize(expected); });
+    const double i16_ms = time_ms([&]() { i16_stage.realize(actual); });
+    const Deviation d = deviation(expected, actual);
+
+    std::cout << stage.first << ": f32 " << f32_ms << " ms, i16 " << i16_ms
+              << " ms, mean deviation " << d.mean << ", max deviation "
+              << d.max << std::endl;
+  }
+  return 0;
+}
+
+/*
+ * finish_stages -- Time of finish with the stage enables as parameters, in
+ * the preview (no denoising or sharpening, one tone mapping pass), fixed
+ * (three tone mapping passes only) and final (all stages) settings, against
+ * finish built without them. Fails unless the fixed setting reproduces the
+ * latter exactly, or if the preview or fixed setting is slower than it, with
+ * 2% allowed for timing noise.
+ */
+int bench_finish_stages(const std::vector<std::string> &args) {
+  const int width = 4096, height = 3072;
+  std::vector<Shift> shifts;
+  Buffer<uint16_t> truth = synthetic_burst(width, height, 3, shifts, 400.f);
+
+  Buffer<uint16_t> mosaic(width, height);
+  mosaic.for_each_element([&](int x, int y) {
+    mosaic(x, y) = truth(x, y, (x % 2) + (y % 2));
+  });
+
+  Buffer<float> ccm(3, 3);
+  ccm.for_each_element([&](int r, int c) { ccm(r, c) = r == c ? 1.f : 0.f; });
+
+  const CompiletimeWhiteBalance wb{1.f, 1.f, 1.f, 1.f};
+  const int rggb = int(CfaPattern::CFA_RGGB);
+  const float comp = 3.8f, gain = 1.1f;
+
+  Param<bool> denoise, sharpen_enable, multi_pass;
+  const FinishStages stages{denoise, sharpen_enable, 2.f, multi_pass, 5.f};
+
+  Func fixed = finish(Func(mosaic), width, height, 0, 65535, wb, rggb,
+                      Func(ccm), comp, gain);
+  Func staged = finish(Func(mosaic), width, height, 0, 65535, wb, rggb,
+                       Func(ccm), comp, gain, {.stages = stages});
+  fixed.compile_jit();
+  staged.compile_jit();
+
+  Buffer<uint8_t> expected(3, width, height), actual(3, width, height);
+  const double fixed_ms = time_ms([&]() { fixed.realize(expected); });
+  std::cout << "without stage inputs " << fixed_ms << " ms" << std::endl;
+
+  int result = 0;
+  const std::vector<std::pair<std::string, std::vector<bool>>> settings = {
+      {"preview", {false, false, false}},
+      {"fixed", {false, false, true}},
+      {"final", {true, true, true}}};
+  for (const auto &setting : settings) {
+    denoise.set(setting.second[0]);
+    sharpen_enable.set(setting.second[1]);
+    multi_pass.set(setting.second[2]);
+    const double ms = time_ms([&]() { staged.realize(actual); });
+    const Deviation d = deviation(expected, actual);
+
+    std::cout << setting.first << ": " << ms << " ms, max deviation " << d.max
+              << std::endl;
+    if (setting.first == "fixed" && d.max != 0) {
+      result = 1;
+    }
+    if (setting.first != "final" && ms > 1.02 * fixed_ms) {
+      result = 1;
+    }
+  }
+  return result;
+}
+
+/*
+ * preview_binning -- Latency of finish at full resolution and with each bayer
+ * quad binned into one pixel, on a synthetic mosaic, and the deviation of the
+ * binned output from the 2x2 means of the full resolution one.
+ */
+int bench_preview_binning(const std::vector<std::string> &args) {
+  const int width = 4096, height = 3072;
+  std::vector<Shift> shifts;
+  Buffer<uint16_t> truth = synthetic_burst(width, height, 3, shifts, 400.f);
+
+  Buffer<uint16_t> mosaic(width, height);
+  mosaic.for_each_element([&](int x, int y) {
+    mosaic(x, y) = truth(x, y, (x % 2) + (y % 2));
+  });
+
+  Buffer<float> ccm(3, 3);
+  ccm.for_each_element([&](int r, int c) { ccm(r, c) = r == c ? 1.f : 0.f; });
+
+  const CompiletimeWhiteBalance wb{1.f, 1.f, 1.f, 1.f};
+  const int rggb = int(CfaPattern::CFA_RGGB);
+  const float comp = 3.8f, gain = 1.1f;
+
+  Func full = finish(Func(mosaic), width, height, 0, 65535, wb, rggb,
+                     Func(ccm), comp, gain,
+                     {.demosaic_algorithm = DemosaicAlgorithm::Malvar});
+  Func binned = finish(Func(mosaic), width, height, 0, 65535, wb, rggb,
+                       Func(ccm), comp, gain,
+                       {.demosaic_algorithm = DemosaicAlgorithm::Binned});
+  full.compile_jit();
+  binned.compile_jit();
+
+  Buffer<uint8_t> full_output(3, width, height);
+  Buffer<uint8_t> binned_output(3, width / 2, height / 2);
+  const double full_ms = time_ms([&]() { full.realize(full_output); }, 3);
+  const double binned_ms =
+      time_ms([&]() { binned.realize(binned_output); }, 3);
+
+  Buffer<uint8_t> full_means(3, width / 2, height / 2);
+  full_means.for_each_element([&](int c, int x, int y) {
+    int total = 2;
+    for (int j = 0; j < 2; j++) {
+      for (int i = 0; i < 2; i++) {
+        total += full_output(c, 2 * x + i, 2 * y + j);
+      }
+    }
+    full_means(c, x, y) = uint8_t(total / 4);
+  });
+  const Deviation d = deviation(full_means, binned_output);
+
+  std::cout << "full resolution " << full_ms << " ms, binned " << binned_ms
+            << " ms (" << full_ms / binned_ms << "x), mean deviation "
+            << d.mean << ", max deviation " << d.max << std::endl;
+  return 0;
+}
+
+/*
+ * roi_render -- Time of align, merge and finish on a synthetic burst for the
+ * whole frame and for regions of interest of decreasing size, realized as
+ * crops of the output buffer. Fails if a region deviates by more than 1 from
+ * the same crop of the whole frame.
+ */
+int bench_roi_render(const std::vector<std::string> &args) {
+  const int width = 4096, height = 3072, frames = 4;
+  std::vector<Shift> shifts;
+  Buffer<uint16_t> burst = synthetic_burst(width, height, frames, shifts);
+
+  Buffer<float> ccm(3, 3);
+  ccm.for_each_element([&](int r, int c) { ccm(r, c) = r == c ? 1.f : 0.f; });
+
+  const CompiletimeWhiteBalance wb{1.f, 1.f, 1.f, 1.f};
+  const int rggb = int(CfaPattern::CFA_RGGB);
+
+  Func imgs(burst);
+  Func alignment = align(imgs, width, height);
+  Func merged = merge(imgs, width, height, frames, alignment);
+  Func finished = finish(merged, width, height, 0, 65535, wb, rggb,
+                         Func(ccm), 3.8f, 1.1f);
+  finished.compile_jit();
+
+  Buffer<uint8_t> full(3, width, height);
+  const double full_ms = time_ms([&]() { finished.realize(full); }, 3);
+  std::cout << "full frame " << width << "x" << height << ": " << full_ms
+            << " ms" << std::endl;
+
+  int result = 0;
+  for (int size : {1536, 768, 384, 192}) {
+    const int x0 = (width - size) / 3, y0 = (height - size) / 3;
+    Buffer<uint8_t> roi(3, size, size);
+    roi.set_min({0, x0, y0});
+    const double ms = time_ms([&]() { finished.realize(roi); }, 3);
+
+    int max_deviation = 0;
+    roi.for_each_element([&](int c, int x, int y) {
+      max_deviation =
+          std::max(max_deviation, std::abs(int(roi(c, x, y)) - full(c, x, y)));
+    });
+
+    std::cout << size << "x" << size << ": " << ms << " ms ("
+              << 100.0 * ms / full_ms << "% of the time for "
+              << 100.0 * size * size / (width * height)
+              << "% of the area), max deviation " << max_deviation
+              << std::endl;
+    if (max_deviation > 1) {
+      result = 1;
+    }
+  }
+  return result;
+}
+
+/*
+ * tracked_malloc, tracked_free -- JIT allocation handlers that keep the bytes
+ * allocated by a pipeline and their peak, for the memory bounds of a render.
+ */
+std::mutex tracked_mutex;
+std::unordered_map<void *, size_t> tracked_sizes;
+size_t tracked_bytes = 0, tracked_peak = 0;
+
+void *tracked_malloc(JITUserContext *, size_t size) {
+  const size_t aligned = (size + 127) / 128 * 128;
+  void *p = std::aligned_alloc(128, aligned);
+  if (p) {
+    std::lock_guard<std::mutex> lock(tracked_mutex);
+    tracked_sizes[p] = aligned;
+    tracked_bytes += aligned;
+    tracked_peak = std::max(tracked_peak, tracked_bytes);
+  }
+  return p;
+}
+
+void tracked_free(JITUserContext *, void *p) {
+  if (p) {
+    std::lock_guard<std::mutex> lock(tracked_mutex);
+    tracked_bytes -= tracked_sizes[p];
+    tracked_sizes.erase(p);
+  }
+  std::free(p);
+}
+
+/*
+ * strip_render -- Renders align, merge and finish of a synthetic burst, with
+ * every finishing stage enabled, in horizontal strips of several heights,
+ * each from only the input rows it needs (found with infer_input_bounds), as
+ * the out-of-core mode does, and prints the time, the input rows read and the
+ * peak allocation per strip next to a whole frame render, and the halo that
+ * bounds the useful strip height from below. Fails if a strip deviates by
+ * more than 1 from the whole frame, or if the intermediates of a strip
+ * allocate more than the per-pixel bounds of StripRenderer over its input
+ * rows.
+ */
+int bench_strip_render(const std::vector<std::string> &args) {
+  const int width = 4096, height = 3072, frames = 4;
+  std::vector<Shift> shifts;
+  Buffer<uint16_t> burst = synthetic_burst(width, height, frames, shifts);
+
+  Buffer<float> ccm(3, 3);
+  ccm.for_each_element([&](int r, int c) { ccm(r, c) = r == c ? 1.f : 0.f; });
+
+  const CompiletimeWhiteBalance wb{1.f, 1.f, 1.f, 1.f};
+  const int rggb = int(CfaPattern::CFA_RGGB);
+
+  // the frame size is a parameter, as input holds only some of its rows
+
+  ImageParam input(UInt(16), 3);
+  Param<int> frame_width, frame_height;
+  frame_width.set(width);
+  frame_height.set(height);
+
+  Param<bool> enable;
+  enable.set(true);
+  const FinishStages stages{enable, enable, 2.f, enable, 5.f};
+
+  Func imgs(input);
+  Func alignment = align(imgs, frame_width, frame_height);
+  Func merged = merge(imgs, frame_width, frame_height, frames, alignment);
+  Func finished = finish(merged, frame_width, frame_height, 0, 65535, wb,
+                         rggb, Func(ccm), 3.8f, 1.1f, {.stages = stages});
+  finished.jit_handlers().custom_malloc = tracked_malloc;
+  finished.jit_handlers().custom_free = tracked_free;
+  finished.compile_jit();
+
+  input.set(burst);
+  Buffer<uint8_t> full(3, width, height);
+  const double full_ms = time_ms([&]() { finished.realize(full); }, 3);
+  std::cout << "whole frame: " << full_ms << " ms, " << height
+            << " input rows" << std::endl;
+
+  // the halo: input rows beyond a single row in the middle of the frame
+
+  Buffer<uint8_t> middle_row(3, width, 1);
+  middle_row.set_min({0, 0, height / 2});
+  input.reset();
+  finished.infer_input_bounds(middle_row);
+  std::cout << "halo: " << input.get().dim(1).extent() - 1 << " rows"
+            << std::endl;
+
+  const size_t bytes_per_pixel =
+      StripRenderer::kIntermediateBytesPerFrame * frames +
+      StripRenderer::kIntermediateBytesPerPixel;
+
+  int result = 0;
+  for (int strip_height : {1024, 512, 256}) {
+    int max_rows = 0, max_deviation = 0;
+    double max_bytes_per_pixel = 0.0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int y = 0; y < height; y += strip_height) {
+      Buffer<uint8_t> strip(3, width, std::min(strip_height, height - y));
+      strip.set_min({0, 0, y});
+
+      input.reset();
+      finished.infer_input_bounds(strip);
+      const Buffer<uint16_t> required = input.get();
+
+      Buffer<uint16_t> rows(required.dim(0).extent(),
+                            required.dim(1).extent(), frames);
+      rows.set_min({required.dim(0).min(), required.dim(1).min(), 0});
+      rows.copy_from(burst);
+      input.set(rows);
+      tracked_peak = tracked_bytes;
+      finished.realize(strip);
+
+      const size_t covered = size_t(width) * rows.dim(1).extent();
+      max_bytes_per_pixel =
+          std::max(max_bytes_per_pixel, double(tracked_peak) / covered);
+      if (tracked_peak > covered * bytes_per_pixel) {
+        std::cout << "strip at row " << y << " allocates " << tracked_peak
+                  << " bytes, over the bound of " << covered * bytes_per_pixel
+                  << std::endl;
+        result = 1;
+      }
+      max_rows = std::max(max_rows, rows.dim(1).extent());
+      strip.for_each_element([&](int c, int i, int j) {
+        max_deviation = std::max(max_deviation,
+                                 std::abs(int(strip(c, i, j)) - full(c, i, j)));
+      });
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    std::cout << strip_height << " row strips: "
+              << std::chrono::duration<double, std::milli>(end - start).count()
+              << " ms, at most " << max_rows
+              << " input rows per strip, at most " << max_bytes_per_pixel
+              << " of " << bytes_per_pixel
+              << " bytes allocated per input pixel, max deviation "
+              << max_deviation << std::endl;
+    if (max_deviation > 1) {
+      result = 1;
+    }
+  }
+  return result;
+}
+
+/*
+ * output_depth -- Latency of finish with each output format on a synthetic
+ * mosaic, and the deviation of the 8-bit output from the 16-bit
+ * display-referred one divided by 256, which should be none.
+ */
+int bench_output_depth(const std::vector<std::string> &args) {
+  const int width = 4096, height = 3072;
+  std::vector<Shift> shifts;
+  Buffer<uint16_t> truth = synthetic_burst(width, height, 3, shifts);
+
+  Buffer<uint16_t> mosaic(width, height);
+  mosaic.for_each_element([&](int x, int y) {
+    mosaic(x, y) = truth(x, y, (x % 2) + (y % 2));
+  });
+
+  Buffer<float> ccm(3, 3);
+  ccm.for_each_element([&](int r, int c) { ccm(r, c) = r == c ? 1.f : 0.f; });
+
+  const CompiletimeWhiteBalance wb{1.f, 1.f, 1.f, 1.f};
+  const int rggb = int(CfaPattern::CFA_RGGB);
+
+  auto finish_as = [&](OutputFormat format) {
+    Func output = finish(Func(mosaic), width, height, 0, 65535, wb, rggb,
+                         Func(ccm), 3.8f, 1.1f, {.output_format = format});
+    output.compile_jit();
+    return output;
+  };
+  Func u8 = finish_as(OutputFormat::U8);
+  Func u16 = finish_as(OutputFormat::U16);
+  Func linear = finish_as(OutputFormat::U16Linear);
+
+  Buffer<uint8_t> display8(3, width, height);
+  Buffer<uint16_t> display16(3, width, height), linear16(3, width, height);
+  const double u8_ms = time_ms([&]() { u8.realize(display8); }, 3);
+  const double u16_ms = time_ms([&]() { u16.realize(display16); }, 3);
+  const double linear_ms = time_ms([&]() { linear.realize(linear16); }, 3);
+
+  Buffer<uint8_t> truncated(3, width, height);
+  truncated.for_each_element([&](int c, int x, int y) {
+    truncated(c, x, y) = uint8_t(display16(c, x, y) / 256);
+  });
+  const Deviation d = deviation(display8, truncated);
+
+  std::cout << "u8: " << u8_ms << " ms" << std::endl
+            << "u16: " << u16_ms << " ms, max deviation " << d.max
+            << " from u8 after conversion" << std::endl
+            << "u16_linear: " << linear_ms << " ms" << std::endl;
+  return d.max == 0 ? 0 : 1;
+}
+
+const std::map<std::string,
+               std::function<int(const std::vector<std::string> &)>>
+    benchmarks = {
+        {"align_seeded", bench_align_seeded},
+        {"align_telemetry", bench_align_telemetry},
+        {"bilateral_grid", bench_bilateral_grid},
+        {"color_fold", bench_color_fold},
+        {"demosaic", bench_demosaic},
+        {"demosaic_modes", bench_demosaic_modes},
+        {"finish_stages", bench_finish_stages},
+        {"gamma_lut", bench_gamma_lut},
+        {"gauss_blurs", bench_gauss_blurs},
+        {"gauss_down4", bench_gauss_down4},
+        {"merge_fixed_point", bench_merge_fixed_point},
+        {"merge_frequency", bench_merge_frequency},
+        {"merge_long_burst", bench_merge_long_burst},
+        {"merge_spatial", bench_merge_spatial},
+        {"merge_sparse", bench_merge_sparse},
+        {"normalize_raw", bench_normalize_raw},
+        {"output_depth", bench_output_depth},
+        {"preview_binning", bench_preview_binning},
+        {"roi_render", bench_roi_render},
+        {"sharpness", bench_sharpness},
+        {"strip_render", bench_strip_render},
+        {"tone_curve", bench_tone_curve},
+        {"tone_map_reduced", bench_tone_map_reduced},
+        {"yuv_fixed_point", bench_yuv_fixed_point},
+};
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc < 2 || benchmarks.find(argv[1]) == benchmarks.end()) {
+    std::cerr << "Usage: " << argv[0] << " benchmark [dir_path raw_img1 ...]"
+              << std::endl
+              << "Benchmarks:";
+    for (const auto &benchmark : benchmarks) {
+      std::cerr << " " << benchmark.first;
+    }
+    std::cerr << std::endl;
+    return 1;
+  }
+
+  const std::vector<std::string> args(argv + 2, argv + argc);
+  return benchmarks.at(argv[1])(args);
+}
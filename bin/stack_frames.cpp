@@ -1,3 +1,4 @@
+#include <chrono>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
@@ -6,32 +7,151 @@
 
 #include <Halide.h>
 
+#include <src/AlignmentTelemetry.h>
 #include <src/Burst.h>
+#include <src/ReferenceSelection.h>
+#include <src/StreamingMerge.h>
 
 #include <align_and_merge.h>
+#include <align_and_merge_telemetry.h>
+#include <align_frame.h>
+#include <align_frame_full.h>
+#include <merge_aligned.h>
 
 Halide::Runtime::Buffer<uint16_t>
-align_and_merge(Halide::Runtime::Buffer<uint16_t> burst) {
+align_and_merge(Halide::Runtime::Buffer<uint16_t> burst, bool telemetry) {
   if (burst.channels() < 2) {
     return {};
   }
   Halide::Runtime::Buffer<uint16_t> merged_buffer(burst.width(),
                                                   burst.height());
-  align_and_merge(burst, merged_buffer);
+  if (telemetry) {
+    auto telemetry_buffer = AllocateAlignmentTelemetry();
+    const auto start = std::chrono::steady_clock::now();
+    align_and_merge_telemetry(burst, merged_buffer, telemetry_buffer);
+    const auto end = std::chrono::steady_clock::now();
+    PrintAlignmentTelemetry(
+        telemetry_buffer,
+        std::chrono::duration<double, std::milli>(end - start).count(),
+        std::cerr);
+  } else {
+    align_and_merge(burst, merged_buffer);
+  }
   return merged_buffer;
 }
 
+/*
+ * align_and_merge_seeded -- Aligns the alternate frames one at a time, seeding
+ * each frame's search with the offsets found for the previous frame, then
+ * merges the burst with the resulting offsets. The first alternate frame has
+ * no predecessor and is aligned with the full hierarchical search of align(),
+ * over every pyramid level.
+ */
+Halide::Runtime::Buffer<uint16_t>
+align_and_merge_seeded(Halide::Runtime::Buffer<uint16_t> burst,
+                       int search_radius) {
+  if (burst.channels() < 2) {
+    return {};
+  }
+  const int num_tx = burst.width() / 16 - 1;
+  const int num_ty = burst.height() / 16 - 1;
+
+  Halide::Runtime::Buffer<int16_t> alignment(num_tx, num_ty,
+                                             burst.channels(), 2);
+  alignment.fill(0);
+
+  const auto start = std::chrono::steady_clock::now();
+  for (int n = 1; n < burst.channels(); n++) {
+    auto frame_alignment = alignment.sliced(2, n);
+    if (n == 1) {
+      align_frame_full(burst.sliced(2, 0), burst.sliced(2, n),
+                       frame_alignment);
+    } else {
+      auto seed = alignment.sliced(2, n - 1);
+      align_frame(burst.sliced(2, 0), burst.sliced(2, n), seed, search_radius,
+                  frame_alignment);
+    }
+  }
+  const auto end = std::chrono::steady_clock::now();
+  std::cerr << "seeded alignment: "
+            << std::chrono::duration<double, std::milli>(end - start).count()
+            << " ms" << std::endl;
+
+  Halide::Runtime::Buffer<uint16_t> merged_buffer(burst.width(),
+                                                  burst.height());
+  merge_aligned(burst, alignment, merged_buffer);
+  return merged_buffer;
+}
+
+/*
+ * align_and_merge_streaming -- Merges the burst while decoding one alternate
+ * frame at a time, so only the reference, its alignment pyramid and the
+ * running merge sums stay in memory. The reference raw is kept for writing
+ * the DNG.
+ */
+Halide::Runtime::Buffer<uint16_t>
+align_and_merge_streaming(const RawImage &reference,
+                          const std::string &dir_path,
+                          const std::vector<std::string> &alternate_names) {
+  Halide::Runtime::Buffer<uint16_t> reference_buffer(reference.GetWidth(),
+                                                     reference.GetHeight());
+  reference.CopyToBuffer(reference_buffer);
+
+  StreamingMerge merge(reference_buffer);
+  Halide::Runtime::Buffer<uint16_t> frame(reference.GetWidth(),
+                                          reference.GetHeight());
+  for (const auto &name : alternate_names) {
+    RawImage(dir_path + "/" + name).CopyToBuffer(frame);
+    merge.AddFrame(frame);
+  }
+  std::cerr << "streamed frames: " << merge.GetFrameCount() << std::endl;
+  return merge.Finish();
+}
+
 int main(int argc, char *argv[]) {
   if (argc < 3) {
     std::cerr << "Usage: " << argv[0]
-              << " dir_path out_img raw_img1 raw_img2 [...]" << std::endl;
+              << " [-i -r -s radius -t (optional)] dir_path out_img raw_img1 "
+                 "raw_img2 [...]"
+              << std::endl;
     return 1;
   }
 
+  int seed_search_radius = 0;
+  bool telemetry = false;
+  bool streaming = false;
+  bool sharpest_reference = false;
+
   int i = 1;
+
+  while (argv[i][0] == '-') {
+    if (argv[i][1] == 'i') {
+      streaming = true;
+      i++;
+      continue;
+    } else if (argv[i][1] == 'r') {
+      sharpest_reference = true;
+      i++;
+      continue;
+    } else if (argv[i][1] == 's') {
+      seed_search_radius = std::stoi(argv[++i]);
+      i++;
+      continue;
+    } else if (argv[i][1] == 't') {
+      telemetry = true;
+      i++;
+      continue;
+    } else {
+      std::cerr << "Invalid flag '" << argv[i][1] << "'" << std::endl;
+      return 1;
+    }
+  }
+
   if (argc - i < 3) {
     std::cerr << "Usage: " << argv[0]
-              << " dir_path out_img raw_img1 raw_img2 [...]" << std::endl;
+              << " [-i -r -s radius -t (optional)] dir_path out_img raw_img1 "
+                 "raw_img2 [...]"
+              << std::endl;
     return 1;
   }
 
@@ -42,14 +162,55 @@ int main(int argc, char *argv[]) {
   while (i < argc)
     in_names.push_back(argv[i++]);
 
+  const std::string merged_filename = dir_path + "/" + out_name;
+
+  if (streaming && sharpest_reference) {
+    std::cerr << "-r needs the whole burst and cannot be combined with -i"
+              << std::endl;
+    return 1;
+  }
+  if (streaming && (seed_search_radius > 0 || telemetry)) {
+    std::cerr << "-i merges frame by frame and cannot be combined with -s or -t"
+              << std::endl;
+    return 1;
+  }
+  if (seed_search_radius > 0 && telemetry) {
+    std::cerr << "-s aligns frame by frame and cannot be combined with -t"
+              << std::endl;
+    return 1;
+  }
+
+  if (streaming) {
+    const RawImage raw(dir_path + "/" + in_names[0]);
+    const std::vector<std::string> alternate_names(in_names.begin() + 1,
+                                                   in_names.end());
+    const auto merged =
+        align_and_merge_streaming(raw, dir_path, alternate_names);
+    std::cerr << "merged size: " << merged.width() << " " << merged.height()
+              << std::endl;
+    raw.WriteDng(merged_filename, merged);
+    return EXIT_SUCCESS;
+  }
+
   Burst burst(dir_path, in_names);
+  Halide::Runtime::Buffer<uint16_t> imgs = burst.ToBuffer();
+
+  int reference = 0;
+  if (sharpest_reference) {
+    double scoring_ms = 0;
+    reference = SelectSharpestReference(imgs, scoring_ms);
+    std::cerr << "reference frame: " << reference << " (scored in "
+              << scoring_ms << " ms)" << std::endl;
+  }
 
-  const auto merged = align_and_merge(burst.ToBuffer());
+  const auto merged =
+      seed_search_radius > 0
+          ? align_and_merge_seeded(imgs, seed_search_radius)
+          : align_and_merge(imgs, telemetry);
   std::cerr << "merged size: " << merged.width() << " " << merged.height()
             << std::endl;
 
-  const RawImage &raw = burst.GetRaw(0);
-  const std::string merged_filename = dir_path + "/" + out_name;
+  const RawImage &raw = burst.GetRaw(reference);
   raw.WriteDng(merged_filename, merged);
 
   return EXIT_SUCCESS;
@@ -53,6 +53,7 @@
             cp stack_frames $out/bin/
             cp test_buffer_io $out/bin/
             cp test_jni_simulation $out/bin/
+            cp benchmark_stages $out/bin/
             cp libhdrplus_jni.so $out/lib/
 
             runHook postInstall
@@ -0,0 +1,66 @@
+#include "AlignmentTelemetry.h"
+
+#include "align.h"
+
+#include <algorithm>
+
+namespace {
+
+// Lower edge of the bin containing the given fraction of a histogram row.
+int Percentile(const Halide::Runtime::Buffer<uint32_t> &telemetry, int row,
+               double fraction) {
+  uint64_t total = 0;
+  for (int bin = 0; bin < TELEMETRY_BINS; ++bin) {
+    total += telemetry(bin, row);
+  }
+  uint64_t count = 0;
+  for (int bin = 0; bin < TELEMETRY_BINS; ++bin) {
+    count += telemetry(bin, row);
+    if (count > 0 && count >= fraction * total) {
+      return bin;
+    }
+  }
+  return TELEMETRY_BINS - 1;
+}
+
+void PrintOffsetHistogram(const Halide::Runtime::Buffer<uint32_t> &telemetry,
+                          int row, std::ostream &out) {
+  for (int bin = 0; bin < TELEMETRY_BINS; ++bin) {
+    if (telemetry(bin, row) != 0) {
+      out << " " << MIN_OFFSET + 2 * bin << ":" << telemetry(bin, row);
+    }
+  }
+  out << std::endl;
+}
+
+} // namespace
+
+Halide::Runtime::Buffer<uint32_t> AllocateAlignmentTelemetry() {
+  return Halide::Runtime::Buffer<uint32_t>(TELEMETRY_BINS,
+                                           2 * TELEMETRY_LEVELS + 2);
+}
+
+void PrintAlignmentTelemetry(const Halide::Runtime::Buffer<uint32_t> &telemetry,
+                             double milliseconds, std::ostream &out) {
+  out << "Alignment telemetry (pipeline time " << milliseconds << " ms)"
+      << std::endl;
+
+  for (int level = 0; level < TELEMETRY_LEVELS; ++level) {
+    const int edge_row = TELEMETRY_LEVELS + level;
+    const double tiles = std::max<uint32_t>(1, telemetry(3, edge_row));
+
+    out << "  level " << level << ": " << telemetry(3, edge_row)
+        << " tiles, best score p10/p50/p90 "
+        << Percentile(telemetry, level, 0.1) * TELEMETRY_SCORE_BIN << "/"
+        << Percentile(telemetry, level, 0.5) * TELEMETRY_SCORE_BIN << "/"
+        << Percentile(telemetry, level, 0.9) * TELEMETRY_SCORE_BIN
+        << ", search edge hits x " << 100. * telemetry(0, edge_row) / tiles
+        << "% y " << 100. * telemetry(1, edge_row) / tiles << "% any "
+        << 100. * telemetry(2, edge_row) / tiles << "%" << std::endl;
+  }
+
+  out << "  final x offsets:";
+  PrintOffsetHistogram(telemetry, 2 * TELEMETRY_LEVELS, out);
+  out << "  final y offsets:";
+  PrintOffsetHistogram(telemetry, 2 * TELEMETRY_LEVELS + 1, out);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <ostream>
+
+#include <HalideBuffer.h>
+
+// Allocates a buffer for the 'telemetry' output of the align_and_merge and
+// hdrplus_pipeline generators built with alignment_telemetry=true.
+Halide::Runtime::Buffer<uint32_t> AllocateAlignmentTelemetry();
+
+// Writes a summary of alignment telemetry (see align.h for the layout) along
+// with the wall time spent in the pipeline that produced it.
+void PrintAlignmentTelemetry(const Halide::Runtime::Buffer<uint32_t> &telemetry,
+                             double milliseconds, std::ostream &out);
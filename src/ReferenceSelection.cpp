@@ -0,0 +1,42 @@
+#include "ReferenceSelection.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+#include <sharpness.h>
+
+int SelectSharpestReference(Halide::Runtime::Buffer<uint16_t> &burst,
+                            double &scoring_milliseconds) {
+  if (burst.dimensions() != 3) {
+    throw std::invalid_argument(
+        "Reference selection needs a 3-dimensional burst buffer.");
+  }
+  const int frames = burst.extent(2);
+
+  Halide::Runtime::Buffer<float> scores(frames);
+  const auto start = std::chrono::steady_clock::now();
+  if (int err = sharpness(burst, scores)) {
+    throw std::runtime_error("sharpness pipeline failed with error code: " +
+                             std::to_string(err));
+  }
+  const auto end = std::chrono::steady_clock::now();
+  scoring_milliseconds =
+      std::chrono::duration<double, std::milli>(end - start).count();
+
+  int reference = 0;
+  for (int n = 1; n < frames; ++n) {
+    if (scores(n) > scores(reference)) {
+      reference = n;
+    }
+  }
+
+  if (reference != 0) {
+    Halide::Runtime::Buffer<uint16_t> first = burst.sliced(2, 0).copy();
+    auto first_slice = burst.sliced(2, 0);
+    auto reference_slice = burst.sliced(2, reference);
+    first_slice.copy_from(reference_slice);
+    reference_slice.copy_from(first);
+  }
+  return reference;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <HalideBuffer.h>
+
+// Scores the frames of burst (width, height, frames) with the sharpness
+// pipeline and swaps the sharpest frame into position 0, where align_and_merge
+// and hdrplus_pipeline expect the reference. Returns the original index of the
+// new reference and stores the time spent scoring in milliseconds.
+int SelectSharpestReference(Halide::Runtime::Buffer<uint16_t> &burst,
+                            double &scoring_milliseconds);
@@ -0,0 +1,101 @@
+#include "StreamingMerge.h"
+
+#include <stdexcept>
+#include <string>
+
+#include <merge_finish.h>
+#include <merge_frame.h>
+#include <reference_pyramid.h>
+
+namespace {
+
+// Size of the tiles of the temporal merge and their spacing.
+constexpr int kTileSize = 32;
+constexpr int kTileStride = 16;
+
+// Margins of the alignment pyramid layers of the reference around the image.
+// The reference is only read at tile positions, never at an offset, but the
+// tiles overhang the layers: the merge reads layer 0 tiles -1 ... width / 16
+// - 1, and each coarser layer's tiles are found by rounding down, so tile -1
+// and a partial tile past the far edge are read too. That is at most 8 pixels
+// before and 12 after each layer, filled with the mirrored image as in the
+// non-streaming pipeline (merge_frame clamps reads beyond the margins).
+constexpr std::array<int, 3> kLayerMargins = {16, 16, 16};
+
+// Allocates a buffer of the given extents translated to start at -margin.
+template <typename T>
+Halide::Runtime::Buffer<T> AllocateWithMargin(int width, int height,
+                                              int margin) {
+  Halide::Runtime::Buffer<T> buffer(width + 2 * margin, height + 2 * margin);
+  buffer.translate({-margin, -margin});
+  return buffer;
+}
+
+} // namespace
+
+StreamingMerge::StreamingMerge(Halide::Runtime::Buffer<uint16_t> reference)
+    : Reference(std::move(reference)) {
+  if (Reference.dimensions() != 2) {
+    throw std::invalid_argument(
+        "The reference of a streaming merge must be a 2-dimensional buffer.");
+  }
+  const int width = Reference.width();
+  const int height = Reference.height();
+
+  ReferencePyramid[0] =
+      AllocateWithMargin<uint16_t>(width / 2, height / 2, kLayerMargins[0]);
+  ReferencePyramid[1] =
+      AllocateWithMargin<uint16_t>(width / 8, height / 8, kLayerMargins[1]);
+  ReferencePyramid[2] =
+      AllocateWithMargin<uint16_t>(width / 32, height / 32, kLayerMargins[2]);
+
+  if (int err = reference_pyramid(Reference, ReferencePyramid[0],
+                                  ReferencePyramid[1], ReferencePyramid[2])) {
+    throw std::runtime_error("reference_pyramid failed with error code: " +
+                             std::to_string(err));
+  }
+
+  // tiles -1 ... size / kTileStride - 1 are read by the spatial merge
+
+  const int tiles_x = width / kTileStride + 1;
+  const int tiles_y = height / kTileStride + 1;
+
+  Sum = Halide::Runtime::Buffer<float>(kTileSize, kTileSize, tiles_x, tiles_y);
+  Sum.translate({0, 0, -1, -1});
+  Sum.fill(0.f);
+
+  Weight = Halide::Runtime::Buffer<float>(tiles_x, tiles_y);
+  Weight.translate({-1, -1});
+  Weight.fill(0.f);
+}
+
+void StreamingMerge::AddFrame(Halide::Runtime::Buffer<uint16_t> frame) {
+  if (frame.width() != Reference.width() ||
+      frame.height() != Reference.height()) {
+    throw std::invalid_argument(
+        "All frames of a streaming merge must have the size of the reference.");
+  }
+  // the accumulators are updated in place
+  if (int err = merge_frame(ReferencePyramid[0], ReferencePyramid[1],
+                            ReferencePyramid[2], frame, Sum, Weight, Sum,
+                            Weight)) {
+    throw std::runtime_error("merge_frame failed with error code: " +
+                             std::to_string(err));
+  }
+  FrameCount++;
+}
+
+Halide::Runtime::Buffer<uint16_t> StreamingMerge::Finish() const {
+  // shallow copies; the generated pipelines take non-const buffers
+  Halide::Runtime::Buffer<uint16_t> reference = Reference;
+  Halide::Runtime::Buffer<float> sum = Sum;
+  Halide::Runtime::Buffer<float> weight = Weight;
+
+  Halide::Runtime::Buffer<uint16_t> output(reference.width(),
+                                           reference.height());
+  if (int err = merge_finish(reference, sum, weight, output)) {
+    throw std::runtime_error("merge_finish failed with error code: " +
+                             std::to_string(err));
+  }
+  return output;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <array>
+
+#include <HalideBuffer.h>
+
+// Merges a burst one alternate frame at a time, using the reference_pyramid,
+// merge_frame and merge_finish pipelines. Only the reference frame, its
+// alignment pyramid and the running temporal merge sums are held, so peak
+// memory does not depend on the number of frames. The result matches the
+// align_and_merge pipeline to within 1 LSB.
+class StreamingMerge {
+public:
+  explicit StreamingMerge(Halide::Runtime::Buffer<uint16_t> reference);
+
+  ~StreamingMerge() = default;
+
+  // Aligns an alternate frame against the reference and accumulates it.
+  void AddFrame(Halide::Runtime::Buffer<uint16_t> frame);
+
+  // Returns the merged frame of the reference and all added frames.
+  Halide::Runtime::Buffer<uint16_t> Finish() const;
+
+  int GetFrameCount() const { return FrameCount; }
+
+private:
+  Halide::Runtime::Buffer<uint16_t> Reference;
+  std::array<Halide::Runtime::Buffer<uint16_t>, 3> ReferencePyramid;
+  Halide::Runtime::Buffer<float> Sum;
+  Halide::Runtime::Buffer<float> Weight;
+  int FrameCount = 1;
+};
@@ -0,0 +1,235 @@
+#include "StripRenderer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+
+#include <hdrplus_pipeline_strips.h>
+#include <hdrplus_pipeline_strips_u16.h>
+
+#include "InputSource.h"
+
+namespace {
+
+// Rows of a frame copied to the spill file at a time.
+constexpr int kSpillRows = 256;
+
+// Returns a path for a spill file that no other renderer uses.
+std::string UniqueSpillPath() {
+  static std::atomic<int> counter{0};
+  const auto stamp = std::chrono::steady_clock::now().time_since_epoch();
+  return (std::filesystem::temp_directory_path() /
+          ("hdrplus_strips_" + std::to_string(stamp.count()) + "_" +
+           std::to_string(counter++) + ".raw"))
+      .string();
+}
+
+} // namespace
+
+StripRenderer::StripRenderer(const std::string &dir_path,
+                             const std::vector<std::string> &inputs)
+    : SpillPath(UniqueSpillPath()) {
+  if (inputs.size() < 2) {
+    throw std::invalid_argument(
+        "The burst of a StripRenderer must have at least two frames.");
+  }
+
+  Spill.open(SpillPath, std::ios::in | std::ios::out | std::ios::binary |
+                            std::ios::trunc);
+  if (!Spill) {
+    throw std::runtime_error("Cannot create spill file " + SpillPath);
+  }
+
+  // frames are spilled in order, row by row: sample (x, y, n) is at index
+  // (n * Height + y) * Width + x
+
+  for (const auto &input : inputs) {
+    const RawImage raw(dir_path + "/" + input);
+    if (Frames == 0) {
+      Width = raw.GetWidth();
+      Height = raw.GetHeight();
+      BlackLevel = raw.GetScalarBlackLevel();
+      WhiteLevel = raw.GetWhiteLevel();
+      Wb = raw.GetWhiteBalance();
+      Cfa = raw.GetCfaPattern();
+      Ccm = raw.GetColorCorrectionMatrix();
+    } else if (raw.GetWidth() != Width || raw.GetHeight() != Height) {
+      throw std::invalid_argument(
+          input + " does not have the size of the first frame of the burst.");
+    }
+
+    Halide::Runtime::Buffer<uint16_t> chunk(Width, kSpillRows);
+    for (int y = 0; y < Height; y += kSpillRows) {
+      const int rows = std::min(kSpillRows, Height - y);
+      Halide::Runtime::Buffer<uint16_t> part(chunk.data(), Width, rows);
+      part.set_min({0, y});
+      raw.CopyToBuffer(part);
+      Spill.write(reinterpret_cast<const char *>(part.data()),
+                  std::streamsize(sizeof(uint16_t)) * Width * rows);
+    }
+    if (!Spill) {
+      throw std::runtime_error("Cannot write spill file " + SpillPath);
+    }
+    Frames++;
+  }
+}
+
+StripRenderer::~StripRenderer() {
+  Spill.close();
+  std::error_code ignored;
+  std::filesystem::remove(SpillPath, ignored);
+}
+
+void StripRenderer::ReadRows(Halide::Runtime::Buffer<uint16_t> &rows) {
+  const int x_min = rows.dim(0).min();
+  const int x_extent = rows.dim(0).extent();
+  for (int n = rows.dim(2).min(); n <= rows.dim(2).max(); n++) {
+    for (int y = rows.dim(1).min(); y <= rows.dim(1).max(); y++) {
+      const std::streamoff index =
+          (std::streamoff(n) * Height + y) * Width + x_min;
+      Spill.seekg(index * std::streamoff(sizeof(uint16_t)));
+      Spill.read(reinterpret_cast<char *>(&rows(x_min, y, n)),
+                 std::streamsize(sizeof(uint16_t)) * x_extent);
+    }
+  }
+  if (!Spill) {
+    throw std::runtime_error("Cannot read spill file " + SpillPath);
+  }
+}
+
+template <typename T, typename Pipeline>
+void StripRenderer::Run(Pipeline pipeline, const char *pipeline_name,
+                        const Options &options,
+                        Halide::Runtime::Buffer<uint16_t> &input,
+                        Halide::Runtime::Buffer<T> &output) {
+  if (int err = pipeline(input, BlackLevel, WhiteLevel, Wb.r, Wb.g0, Wb.g1,
+                         Wb.b, static_cast<int>(Cfa), Ccm, options.c,
+                         options.g, options.chroma_denoise, options.sharpen,
+                         options.sharpen_strength, options.multi_pass_tone_map,
+                         options.contrast_strength, Width, Height, output)) {
+    throw std::runtime_error(std::string(pipeline_name) +
+                             " failed with error code: " + std::to_string(err));
+  }
+}
+
+Halide::Runtime::Buffer<uint16_t> StripRenderer::RequiredInput(int y,
+                                                               int rows) {
+  // the region does not depend on the values of the options
+  const Options options{1.f, 1.f, true, true, 1.f, true, 1.f};
+
+  Halide::Runtime::Buffer<uint8_t> strip(3, Width, rows);
+  strip.set_min({0, 0, y});
+
+  Halide::Runtime::Buffer<uint16_t> query(nullptr, Width, Height, Frames);
+  Run(hdrplus_pipeline_strips, "hdrplus_pipeline_strips", options, query,
+      strip);
+  return query;
+}
+
+int StripRenderer::GetHaloRows() {
+  if (HaloRows < 0) {
+    // a single row in the middle of the frame, clear of the clamping to the
+    // frame at the top and bottom
+    const int y = Height / 2;
+    HaloRows = RequiredInput(y, 1).dim(1).extent() - 1;
+  }
+  return HaloRows;
+}
+
+size_t StripRenderer::CoveredRowBytes() const {
+  const size_t per_frame = sizeof(uint16_t) + kIntermediateBytesPerFrame;
+  return size_t(Width) * (per_frame * Frames + kIntermediateBytesPerPixel);
+}
+
+size_t StripRenderer::OutputRowBytes() const {
+  return size_t(Width) * 3 * sizeof(uint16_t);
+}
+
+size_t StripRenderer::StripInputBytes(int strip_height) {
+  const int rows = std::min(strip_height + GetHaloRows(), Height);
+  return sizeof(uint16_t) * size_t(Width) * rows * Frames;
+}
+
+size_t StripRenderer::StripWorkingSetBytes(int strip_height) {
+  const int rows = std::min(strip_height + GetHaloRows(), Height);
+  return CoveredRowBytes() * rows +
+         OutputRowBytes() * std::min(strip_height, Height);
+}
+
+int StripRenderer::StripHeightForBudget(size_t budget) {
+  if (budget >= StripWorkingSetBytes(Height)) {
+    return Height;
+  }
+  // a strip of h rows covers h + halo rows, fewer than the frame here
+  const size_t halo = GetHaloRows();
+  if (budget < CoveredRowBytes() * halo) {
+    return 0;
+  }
+  const size_t rows = (budget - CoveredRowBytes() * halo) /
+                      (CoveredRowBytes() + OutputRowBytes());
+  if (rows < halo) {
+    return 0;
+  }
+  return int(std::min(rows, size_t(Height)));
+}
+
+template <typename T, typename Pipeline>
+void StripRenderer::RenderStrips(
+    int strip_height, const Options &options, Pipeline pipeline,
+    const char *pipeline_name,
+    const std::function<void(const Halide::Runtime::Buffer<T> &)> &sink) {
+  if (strip_height < 1) {
+    throw std::invalid_argument("The strip height must be positive.");
+  }
+  if (strip_height < Height && strip_height < GetHaloRows()) {
+    throw std::invalid_argument(
+        "The strip height must be at least the " +
+        std::to_string(GetHaloRows()) +
+        " rows of the halo that each strip recomputes.");
+  }
+
+  auto run = [&](Halide::Runtime::Buffer<uint16_t> &input,
+                 Halide::Runtime::Buffer<T> &output) {
+    Run(pipeline, pipeline_name, options, input, output);
+  };
+
+  for (int y = 0; y < Height; y += strip_height) {
+    const int rows = std::min(strip_height, Height - y);
+
+    Halide::Runtime::Buffer<T> strip(3, Width, rows);
+    strip.set_min({0, 0, y});
+
+    // a bounds query sets the region of the input that the strip needs
+
+    Halide::Runtime::Buffer<uint16_t> query(nullptr, Width, Height, Frames);
+    run(query, strip);
+
+    Halide::Runtime::Buffer<uint16_t> input(
+        query.dim(0).extent(), query.dim(1).extent(), query.dim(2).extent());
+    input.set_min(
+        {query.dim(0).min(), query.dim(1).min(), query.dim(2).min()});
+    ReadRows(input);
+
+    run(input, strip);
+    sink(strip);
+  }
+}
+
+void StripRenderer::Render(
+    int strip_height, const Options &options,
+    const std::function<void(const Halide::Runtime::Buffer<uint8_t> &)>
+        &sink) {
+  RenderStrips<uint8_t>(strip_height, options, hdrplus_pipeline_strips,
+                        "hdrplus_pipeline_strips", sink);
+}
+
+void StripRenderer::Render16(
+    int strip_height, const Options &options,
+    const std::function<void(const Halide::Runtime::Buffer<uint16_t> &)>
+        &sink) {
+  RenderStrips<uint16_t>(strip_height, options, hdrplus_pipeline_strips_u16,
+                         "hdrplus_pipeline_strips_u16", sink);
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <HalideBuffer.h>
+
+#include "finish.h"
+
+// Renders a burst with the hdrplus_pipeline_strips pipeline one horizontal
+// strip of the output at a time, for frames too large to hold in memory. The
+// frames are decoded one at a time into a spill file in the temporary
+// directory. Each strip then reads back only the input rows it depends on
+// (the strip plus the halo of the alignment search and the finishing
+// stencils, found with a bounds query of the pipeline), and is handed to the
+// caller as soon as it is rendered. Peak memory is one decoded frame while
+// spilling, then the input rows, intermediates and output of a single strip,
+// none of which depend on the frame height.
+//
+// Every strip recomputes the alignment pyramid and the merge over its halo,
+// a few hundred rows (GetHaloRows), so strips shorter than the halo redo
+// most of the frame's work for little saving; Render rejects them. The input
+// of a strip is StripInputBytes, and its whole working set (input, the root
+// intermediates of align, merge and finish over the same rows, and output)
+// is at most StripWorkingSetBytes. StripHeightForBudget picks the strip
+// height from a budget for the latter.
+class StripRenderer {
+public:
+  // Upper bounds of the bytes per pixel of the rows a strip covers (the
+  // strip and its halo) that the root intermediates of the pipeline take:
+  // the downsampled frames of the alignment pyramid and of the merge, per
+  // frame, and the merged tiles and the finishing stages with every optional
+  // stage enabled. They are the sums of the sizes of those intermediates,
+  // though finish frees most of them before it allocates the next, which
+  // leaves room for the per-thread scratch of the stencils. The
+  // strip_render case of benchmark_stages checks them against the peak
+  // allocation of the pipeline.
+  static constexpr size_t kIntermediateBytesPerFrame = 2;
+  static constexpr size_t kIntermediateBytesPerPixel = 256;
+
+  StripRenderer(const std::string &dir_path,
+                const std::vector<std::string> &inputs);
+
+  // Removes the spill file.
+  ~StripRenderer();
+
+  StripRenderer(const StripRenderer &) = delete;
+  StripRenderer &operator=(const StripRenderer &) = delete;
+
+  int GetWidth() const { return Width; }
+
+  int GetHeight() const { return Height; }
+
+  // Rows of input beyond a strip that the strip depends on, away from the
+  // top and bottom of the frame. This is the minimum strip height.
+  int GetHaloRows();
+
+  // Bytes of input (every frame of the rows of a strip and its halo) that a
+  // strip of strip_height rows reads.
+  size_t StripInputBytes(int strip_height);
+
+  // Upper bound of the memory a strip of strip_height rows takes while it
+  // renders: its input, the root intermediates over the same rows (see
+  // kIntermediateBytesPerPixel) and its output, at 16 bits.
+  size_t StripWorkingSetBytes(int strip_height);
+
+  // The tallest strip whose working set fits in budget bytes, or 0 if a
+  // strip of GetHaloRows() rows does not fit.
+  int StripHeightForBudget(size_t budget);
+
+  // Options of the finishing stages (see FinishStages).
+  struct Options {
+    Compression c;
+    Gain g;
+    bool chroma_denoise;
+    bool sharpen;
+    float sharpen_strength;
+    bool multi_pass_tone_map;
+    float contrast_strength;
+  };
+
+  // Renders the output top to bottom in strips of strip_height rows, which
+  // must be at least GetHaloRows() unless it covers the whole frame. Each
+  // strip is passed to sink as an interleaved (c, x, y) buffer whose y min is
+  // its first row, and is released once sink returns.
+  void Render(
+      int strip_height, const Options &options,
+      const std::function<void(const Halide::Runtime::Buffer<uint8_t> &)>
+          &sink);
+
+  // The same with the 16-bit display-referred output of the
+  // hdrplus_pipeline_strips_u16 pipeline (see OutputFormat).
+  void Render16(
+      int strip_height, const Options &options,
+      const std::function<void(const Halide::Runtime::Buffer<uint16_t> &)>
+          &sink);
+
+private:
+  // Renders the strips of an output of type T with pipeline, one of the
+  // out-of-core builds of hdrplus_pipeline.
+  template <typename T, typename Pipeline>
+  void RenderStrips(
+      int strip_height, const Options &options, Pipeline pipeline,
+      const char *pipeline_name,
+      const std::function<void(const Halide::Runtime::Buffer<T> &)> &sink);
+
+  // Runs pipeline on input into output, or only queries the region of input
+  // that output depends on if input has no host memory.
+  template <typename T, typename Pipeline>
+  void Run(Pipeline pipeline, const char *pipeline_name,
+           const Options &options, Halide::Runtime::Buffer<uint16_t> &input,
+           Halide::Runtime::Buffer<T> &output);
+
+  // The region of the input that rows y ... y + rows - 1 of the output
+  // depend on, with no host memory.
+  Halide::Runtime::Buffer<uint16_t> RequiredInput(int y, int rows);
+
+  // Fills the region of rows (x, y, n) from the spill file.
+  void ReadRows(Halide::Runtime::Buffer<uint16_t> &rows);
+
+  // Bytes of input and intermediates per row that a strip covers, and of
+  // output per row of the strip itself.
+  size_t CoveredRowBytes() const;
+  size_t OutputRowBytes() const;
+
+  std::string SpillPath;
+  std::fstream Spill;
+  int Width = 0;
+  int Height = 0;
+  int Frames = 0;
+  int HaloRows = -1; // computed on first use
+  int BlackLevel = 0;
+  int WhiteLevel = 0;
+  WhiteBalance Wb{1.f, 1.f, 1.f, 1.f};
+  CfaPattern Cfa = CfaPattern::CFA_UNKNOWN;
+  Halide::Runtime::Buffer<float> Ccm;
+};
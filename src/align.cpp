@@ -4,32 +4,68 @@
 #include "Point.h"
 #include "util.h"
 #include <string>
+#include <vector>
 
 using namespace Halide;
 using namespace Halide::ConciseCasts;
 
+/*
+ * upsample_alignment -- scales the offsets of the previous (coarser) layer to
+ * the tile grid and resolution of the current layer. Clamp to bound the amount
+ * of memory Halide allocates for the current alignment layer.
+ */
+Func upsample_alignment(Func prev_alignment, Point prev_min, Point prev_max) {
+
+  Func output(prev_alignment.name() + "_upsampled");
+
+  Var tx, ty, n;
+
+  output(tx, ty, n) =
+      DOWNSAMPLE_RATE *
+      clamp(P(prev_alignment(prev_tile(tx), prev_tile(ty), n)), prev_min,
+            prev_max);
+
+  return output;
+}
+
+/*
+ * reference_layer -- the reference frame (n = 0) of a layer of the alignment
+ * pyramid.
+ */
+Func reference_layer(Func layer) {
+
+  Func output(layer.name() + "_reference");
+
+  Var x, y;
+
+  output(x, y) = layer(x, y, 0);
+
+  return output;
+}
+
 /*
  * align_layer -- determines the best offset for tiles of the image at a given
- * resolution provided the offsets for the layer above.
+ * resolution, searching [-search_radius, search_radius) around the offsets
+ * provided for this layer by prev_offsets. With with_scores, the alignment
+ * additionally holds the best score of each tile and whether the best offset
+ * lies on the edge of the search window in x and y.
  */
-Func align_layer(Func layer, Func prev_alignment, Point prev_min,
-                 Point prev_max) {
+Func align_layer(Func ref_layer, Func alt_layer, Func prev_offsets,
+                 Expr search_radius = 4, bool with_scores = false) {
 
-  Func scores(layer.name() + "_scores");
-  Func alignment(layer.name() + "_alignment");
+  Func scores(alt_layer.name() + "_scores");
+  Func alignment(alt_layer.name() + "_alignment");
 
   Var xi, yi, tx, ty, n;
   RDom r0(0, 16, 0, 16); // reduction over pixels in tile
-  RDom r1(-4, 8, -4, 8); // reduction over search region; extent clipped to 8
-                         // for SIMD vectorization
+  RDom r1(-search_radius, 2 * search_radius, -search_radius,
+          2 * search_radius); // reduction over search region; by default
+                              // extent clipped to 8 for SIMD vectorization
 
-  // offset from the alignment of the previous layer, scaled to this layer.
-  // Clamp to bound the amount of memory Halide allocates for the current
-  // alignment layer.
+  // offset from the alignment of the previous layer (or a seed), already in
+  // the units of this layer
 
-  Point prev_offset = DOWNSAMPLE_RATE *
-                      clamp(P(prev_alignment(prev_tile(tx), prev_tile(ty), n)),
-                            prev_min, prev_max);
+  Point prev_offset = P(prev_offsets(tx, ty, n));
 
   // indices into layer at a specific tile indices and offsets
 
@@ -42,8 +78,8 @@ Func align_layer(Func layer, Func prev_alignment, Point prev_min,
   // values and L1 distance between reference and alternate layers at specific
   // pixel
 
-  Expr ref_val = layer(x0, y0, 0);
-  Expr alt_val = layer(x, y, n);
+  Expr ref_val = ref_layer(x0, y0);
+  Expr alt_val = alt_layer(x, y, n);
 
   Expr dist = abs(i32(ref_val) - i32(alt_val));
 
@@ -54,7 +90,19 @@ Func align_layer(Func layer, Func prev_alignment, Point prev_min,
 
   // alignment offset for each tile (offset where score is minimum)
 
-  alignment(tx, ty, n) = P(argmin(scores(r1.x, r1.y, tx, ty, n))) + prev_offset;
+  Tuple best = argmin(scores(r1.x, r1.y, tx, ty, n));
+
+  Point offset = P(best) + prev_offset;
+
+  if (with_scores) {
+    Expr edge_x = best[0] == -search_radius || best[0] == search_radius - 1;
+    Expr edge_y = best[1] == -search_radius || best[1] == search_radius - 1;
+
+    alignment(tx, ty, n) =
+        Tuple(offset.x, offset.y, best[2], u8(edge_x), u8(edge_y));
+  } else {
+    alignment(tx, ty, n) = offset;
+  }
 
   ///////////////////////////////////////////////////////////////////////////
   // schedule
@@ -68,18 +116,79 @@ Func align_layer(Func layer, Func prev_alignment, Point prev_min,
 }
 
 /*
- * align -- Aligns multiple raw RGGB frames of a scene in T_SIZE x T_SIZE tiles
- * which overlap by T_SIZE_2 in each dimension. align(imgs)(tile_x, tile_y, n)
- * is a point representing the x and y offset for a tile in layer n that most
- * closely matches that tile in the reference (relative to the reference tile's
- * location)
+ * alignment_telemetry -- Summarizes the alignment of the alternate frames of
+ * a burst from the per-level alignments (finest first, computed with
+ * with_scores) and the final full-resolution alignment. The layout of the
+ * rows is described in align.h.
  */
-Func align(const Halide::Func imgs, Halide::Expr width, Halide::Expr height) {
+Func alignment_telemetry(std::vector<Func> levels, Func alignment,
+                         Expr num_tx, Expr num_ty, Expr frames) {
 
-  Func alignment_3("layer_3_alignment");
-  Func alignment("alignment");
+  Func telemetry("alignment_telemetry");
 
-  Var tx, ty, n;
+  Var bin, row;
+
+  telemetry(bin, row) = u32(0);
+
+  // tiles of each level that are needed by the tiles of the final alignment
+
+  Expr tx_min = 0, tx_max = num_tx - 1;
+  Expr ty_min = 0, ty_max = num_ty - 1;
+
+  for (int level = 0; level < TELEMETRY_LEVELS; level++) {
+
+    RDom r(tx_min, tx_max - tx_min + 1, ty_min, ty_max - ty_min + 1, 1,
+           frames - 1);
+
+    // best score as the mean L1 distance per pixel of the tile
+
+    Expr score = levels[level](r.x, r.y, r.z)[2] / 256;
+    Expr edge_x = levels[level](r.x, r.y, r.z)[3];
+    Expr edge_y = levels[level](r.x, r.y, r.z)[4];
+
+    Expr score_bin = clamp(score / TELEMETRY_SCORE_BIN, 0, TELEMETRY_BINS - 1);
+    Expr edge_row = TELEMETRY_LEVELS + level;
+
+    telemetry(score_bin, level) += u32(1);
+
+    telemetry(0, edge_row) += u32(edge_x);
+    telemetry(1, edge_row) += u32(edge_y);
+    telemetry(2, edge_row) += u32(edge_x | edge_y);
+    telemetry(3, edge_row) += u32(1);
+
+    tx_min = prev_tile(tx_min);
+    tx_max = prev_tile(tx_max);
+    ty_min = prev_tile(ty_min);
+    ty_max = prev_tile(ty_max);
+  }
+
+  // histogram of the final offsets, which are always even
+
+  RDom r(0, num_tx, 0, num_ty, 1, frames - 1);
+
+  Point offset = P(alignment(r.x, r.y, r.z));
+
+  Expr x_bin = clamp((offset.x - MIN_OFFSET) / 2, 0, TELEMETRY_BINS - 1);
+  Expr y_bin = clamp((offset.y - MIN_OFFSET) / 2, 0, TELEMETRY_BINS - 1);
+
+  telemetry(x_bin, 2 * TELEMETRY_LEVELS) += u32(1);
+  telemetry(y_bin, 2 * TELEMETRY_LEVELS + 1) += u32(1);
+
+  ///////////////////////////////////////////////////////////////////////////
+  // schedule
+  ///////////////////////////////////////////////////////////////////////////
+
+  telemetry.compute_root();
+
+  return telemetry;
+}
+
+/*
+ * alignment_pyramid -- The downsampled layers of the alignment pyramid of
+ * imgs(x, y, n), finest first.
+ */
+std::vector<Func> alignment_pyramid(const Halide::Func imgs,
+                                    Halide::Expr width, Halide::Expr height) {
 
   // mirror input with overlapping edges
 
@@ -92,6 +201,23 @@ Func align(const Halide::Func imgs, Halide::Expr width, Halide::Expr height) {
   Func layer_1 = gauss_down4(layer_0, "layer_1");
   Func layer_2 = gauss_down4(layer_1, "layer_2");
 
+  return {layer_0, layer_1, layer_2};
+}
+
+/*
+ * align_pyramid -- Implements align() from the pyramid layers of the
+ * reference and alternate frames. If telemetry is given, it receives the
+ * alignment telemetry for frames 1 ... frames - 1.
+ */
+Func align_pyramid(std::vector<Func> ref_layers, std::vector<Func> alt_layers,
+                   Halide::Expr width, Halide::Expr height, Halide::Expr frames,
+                   Func *telemetry) {
+
+  Func alignment_3("layer_3_alignment");
+  Func alignment("alignment");
+
+  Var tx, ty, n;
+
   // min and max search regions
 
   Point min_search = P(-4, -4);
@@ -111,9 +237,17 @@ Func align(const Halide::Func imgs, Halide::Expr width, Halide::Expr height) {
 
   // hierarchal alignment functions
 
-  Func alignment_2 = align_layer(layer_2, alignment_3, min_3, max_3);
-  Func alignment_1 = align_layer(layer_1, alignment_2, min_2, max_2);
-  Func alignment_0 = align_layer(layer_0, alignment_1, min_1, max_1);
+  bool with_scores = telemetry != nullptr;
+
+  Func alignment_2 =
+      align_layer(ref_layers[2], alt_layers[2],
+                  upsample_alignment(alignment_3, min_3, max_3), 4, with_scores);
+  Func alignment_1 =
+      align_layer(ref_layers[1], alt_layers[1],
+                  upsample_alignment(alignment_2, min_2, max_2), 4, with_scores);
+  Func alignment_0 =
+      align_layer(ref_layers[0], alt_layers[0],
+                  upsample_alignment(alignment_1, min_1, max_1), 4, with_scores);
 
   // number of tiles in the x and y dimensions
 
@@ -125,6 +259,107 @@ Func align(const Halide::Func imgs, Halide::Expr width, Halide::Expr height) {
 
   alignment(tx, ty, n) = 2 * P(alignment_0(tx, ty, n));
 
+  Func alignment_repeat = BoundaryConditions::repeat_edge(
+      alignment, {Range(0, num_tx), Range(0, num_ty)});
+
+  if (telemetry) {
+    *telemetry = alignment_telemetry({alignment_0, alignment_1, alignment_2},
+                                     alignment, num_tx, num_ty, frames);
+  }
+
+  return alignment_repeat;
+}
+
+/*
+ * align -- Aligns multiple raw RGGB frames of a scene in T_SIZE x T_SIZE tiles
+ * which overlap by T_SIZE_2 in each dimension. align(imgs)(tile_x, tile_y, n)
+ * is a point representing the x and y offset for a tile in layer n that most
+ * closely matches that tile in the reference (relative to the reference tile's
+ * location)
+ */
+Func align(const Halide::Func imgs, Halide::Expr width, Halide::Expr height) {
+  std::vector<Func> layers = alignment_pyramid(imgs, width, height);
+  std::vector<Func> ref_layers = {reference_layer(layers[0]),
+                                  reference_layer(layers[1]),
+                                  reference_layer(layers[2])};
+  return align_pyramid(ref_layers, layers, width, height, Expr(), nullptr);
+}
+
+Func align(const Halide::Func imgs, Halide::Expr width, Halide::Expr height,
+           Halide::Expr frames, Halide::Func &telemetry) {
+  std::vector<Func> layers = alignment_pyramid(imgs, width, height);
+  std::vector<Func> ref_layers = {reference_layer(layers[0]),
+                                  reference_layer(layers[1]),
+                                  reference_layer(layers[2])};
+  return align_pyramid(ref_layers, layers, width, height, frames, &telemetry);
+}
+
+Func align(const std::vector<Halide::Func> &ref_layers,
+           const std::vector<Halide::Func> &alt_layers, Halide::Expr width,
+           Halide::Expr height) {
+  return align_pyramid(ref_layers, alt_layers, width, height, Expr(), nullptr);
+}
+
+/*
+ * align_seeded -- Aligns frames like align(), but starts each tile's search
+ * from seed(tile_x, tile_y, n), a full-resolution offset such as the solution
+ * of the previous frame in the burst. The coarsest pyramid level is skipped and
+ * the two finest levels only search [-search_radius, search_radius) around the
+ * seeded offset.
+ */
+Func align_seeded(const Halide::Func imgs, Halide::Expr width,
+                  Halide::Expr height, Halide::Func seed,
+                  Halide::Expr search_radius) {
+
+  Func seed_1("layer_1_seed");
+  Func alignment("seeded_alignment");
+
+  Var tx, ty, n;
+
+  // mirror input with overlapping edges
+
+  Func imgs_mirror = BoundaryConditions::mirror_interior(
+      imgs, {Range(0, width), Range(0, height)});
+
+  // downsampled layers for alignment
+
+  Func layer_0 = box_down2(imgs_mirror, "seeded_layer_0");
+  Func layer_1 = gauss_down4(layer_0, "seeded_layer_1");
+
+  // seed offsets scaled to layer 1 (full resolution is 2 * layer 0 and
+  // layer 0 is DOWNSAMPLE_RATE * layer 1). A layer 1 tile covers the full
+  // resolution tiles 4 * t + 1 ... 4 * t + 4; use one near its center.
+
+  int seed_scale = 2 * DOWNSAMPLE_RATE;
+
+  Point min_seed = P(MIN_OFFSET / seed_scale, MIN_OFFSET / seed_scale);
+  Point max_seed = P(MAX_OFFSET / seed_scale, MAX_OFFSET / seed_scale);
+
+  Point seed_offset = P(seed(DOWNSAMPLE_RATE * tx + 2,
+                             DOWNSAMPLE_RATE * ty + 2, n));
+
+  seed_1(tx, ty, n) = clamp(P(seed_offset.x / seed_scale,
+                              seed_offset.y / seed_scale),
+                            min_seed, max_seed);
+
+  // the finer layer may move at most search_radius away from the seed
+
+  Point min_1 = min_seed - P(search_radius, search_radius);
+  Point max_1 = max_seed + P(search_radius, search_radius);
+
+  Func alignment_1 = align_layer(reference_layer(layer_1), layer_1, seed_1,
+                                 search_radius);
+  Func alignment_0 =
+      align_layer(reference_layer(layer_0), layer_0,
+                  upsample_alignment(alignment_1, min_1, max_1), search_radius);
+
+  // number of tiles in the x and y dimensions
+
+  Expr num_tx = width / T_SIZE_2 - 1;
+  Expr num_ty = height / T_SIZE_2 - 1;
+
+  alignment(tx, ty, n) = 2 * P(alignment_0(tx, ty, n));
+
   Func alignment_repeat = BoundaryConditions::repeat_edge(
       alignment, {Range(0, num_tx), Range(0, num_ty)});
 
@@ -135,3 +370,87 @@ Halide::Func align(Halide::Buffer<uint16_t> imgs) {
   Halide::Func imgs_function(imgs);
   return align(imgs_function, imgs.width(), imgs.height());
 }
+
+/*
+ * sharpness -- Scores each frame of imgs(x, y, n) by the mean squared gradient
+ * of its layer 1 of the alignment pyramid (1/8 resolution), normalized by the
+ * squared mean level so that small exposure changes across the burst do not
+ * affect the ranking. Blurred frames score lower.
+ */
+Func sharpness(const Halide::Func imgs, Halide::Expr width,
+               Halide::Expr height, Halide::Expr frames) {
+
+  Func gradient("sharpness_gradient");
+  Func scores("sharpness_scores");
+
+  Var x, y, n;
+
+  // mirror input with overlapping edges
+
+  Func imgs_mirror = BoundaryConditions::mirror_interior(
+      imgs, {Range(0, width), Range(0, height)});
+
+  // coarse layer, as in the alignment pyramid
+
+  Func layer_0 = box_down2(imgs_mirror, "sharpness_layer_0");
+  Func layer_1 = gauss_down4(layer_0, "sharpness_layer_1");
+
+  // squared gradient over the interior of the layer
+
+  Expr dx = f32(layer_1(x + 1, y, n)) - f32(layer_1(x, y, n));
+  Expr dy = f32(layer_1(x, y + 1, n)) - f32(layer_1(x, y, n));
+
+  gradient(x, y, n) = dx * dx + dy * dy;
+
+  Expr layer_w = width / (2 * DOWNSAMPLE_RATE) - 1;
+  Expr layer_h = height / (2 * DOWNSAMPLE_RATE) - 1;
+
+  RDom r(0, layer_w, 0, layer_h);
+
+  Expr count = f32(layer_w * layer_h);
+  Expr mean = sum(f32(layer_1(r.x, r.y, n))) / count;
+
+  scores(n) = sum(gradient(r.x, r.y, n)) / count / (mean * mean + 1.f);
+
+  ///////////////////////////////////////////////////////////////////////////
+  // schedule
+  ///////////////////////////////////////////////////////////////////////////
+
+  scores.compute_root().parallel(n);
+
+  return scores;
+}
+
+/*
+ * with_sharpest_reference -- Reorders imgs(x, y, n) so that the frame with the
+ * highest sharpness() score becomes frame 0, swapping it with the original
+ * frame 0.
+ */
+Func with_sharpest_reference(const Halide::Func imgs, Halide::Expr width,
+                             Halide::Expr height, Halide::Expr frames) {
+
+  Func reference("sharpest_reference");
+  Func output("sharpest_reference_imgs");
+
+  Var x, y, n;
+
+  Func scores = sharpness(imgs, width, height, frames);
+
+  RDom r(0, frames);
+
+  reference() = argmax(r, scores(r))[0];
+
+  // clamped so that the frame index has known bounds
+
+  Expr ref = clamp(reference(), 0, frames - 1);
+
+  output(x, y, n) = imgs(x, y, select(n == 0, ref, n == ref, 0, n));
+
+  ///////////////////////////////////////////////////////////////////////////
+  // schedule
+  ///////////////////////////////////////////////////////////////////////////
+
+  reference.compute_root();
+
+  return output;
+}
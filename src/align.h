@@ -14,8 +14,17 @@
   4 // Rate at which layers of the alignment pyramid are downsampled relative to
     // each other
 
+#define TELEMETRY_LEVELS 3 // Number of levels of the alignment pyramid
+#define TELEMETRY_BINS                                                         \
+  148 // Bins per row of the alignment telemetry; one per even offset in
+      // [MIN_OFFSET, MAX_OFFSET]
+#define TELEMETRY_SCORE_BIN                                                    \
+  4 // Width of a best score bin, in mean L1 distance per pixel of a tile
+
 #include "Halide.h"
 
+#include <vector>
+
 /*
  * prev_tile -- Returns an index to the nearest tile in the previous level of
  * the pyramid.
@@ -74,3 +83,63 @@ inline Halide::Expr idx_layer(Halide::Expr t, Halide::Expr i) {
 Halide::Func align(Halide::Buffer<uint16_t> imgs);
 Halide::Func align(const Halide::Func imgs, Halide::Expr width,
                    Halide::Expr height);
+
+/*
+ * align -- As above, but also produces telemetry(bin, row) summarizing the
+ * alignment of frames 1 ... frames - 1, with TELEMETRY_BINS bins and
+ * 2 * TELEMETRY_LEVELS + 2 rows:
+ *   row l (l < TELEMETRY_LEVELS): histogram of the best tile scores at pyramid
+ *     level l (0 is the finest), binned by TELEMETRY_SCORE_BIN
+ *   row TELEMETRY_LEVELS + l: tiles of level l whose best offset lies on the
+ *     edge of the search window in x (bin 0), in y (bin 1), in either (bin 2),
+ *     and the number of tiles of level l (bin 3)
+ *   row 2 * TELEMETRY_LEVELS (+ 1): histogram of the final x (y) offsets, bin
+ *     (offset - MIN_OFFSET) / 2
+ */
+Halide::Func align(const Halide::Func imgs, Halide::Expr width,
+                   Halide::Expr height, Halide::Expr frames,
+                   Halide::Func &telemetry);
+
+/*
+ * alignment_pyramid -- The downsampled layers of imgs(x, y, n) that align()
+ * searches, finest first.
+ */
+std::vector<Halide::Func> alignment_pyramid(const Halide::Func imgs,
+                                            Halide::Expr width,
+                                            Halide::Expr height);
+
+/*
+ * align -- As above, but from precomputed pyramids: ref_layers[l](x, y) of the
+ * reference frame and alt_layers[l](x, y, n) of the frames to align, as
+ * produced by alignment_pyramid(). This allows the reference pyramid to be
+ * computed once and reused for frames that are aligned one at a time.
+ */
+Halide::Func align(const std::vector<Halide::Func> &ref_layers,
+                   const std::vector<Halide::Func> &alt_layers,
+                   Halide::Expr width, Halide::Expr height);
+
+/*
+ * align_seeded -- Aligns frames like align(), but starts each tile's search
+ * from seed(tile_x, tile_y, n), a full-resolution offset such as the solution
+ * for the previous frame of the burst. Only the two finest pyramid levels are
+ * searched, each over [-search_radius, search_radius) around the seed.
+ */
+Halide::Func align_seeded(const Halide::Func imgs, Halide::Expr width,
+                          Halide::Expr height, Halide::Func seed,
+                          Halide::Expr search_radius);
+
+/*
+ * sharpness -- Per-frame sharpness scores(n) of imgs(x, y, n), computed on the
+ * coarse alignment pyramid; higher is sharper. Used to pick the reference.
+ */
+Halide::Func sharpness(const Halide::Func imgs, Halide::Expr width,
+                       Halide::Expr height, Halide::Expr frames);
+
+/*
+ * with_sharpest_reference -- imgs(x, y, n) with its sharpest frame (by
+ * sharpness()) swapped into position 0, the reference frame of align() and
+ * merge().
+ */
+Halide::Func with_sharpest_reference(const Halide::Func imgs,
+                                     Halide::Expr width, Halide::Expr height,
+                                     Halide::Expr frames);
@@ -12,11 +12,44 @@ public:
   Input<Halide::Buffer<uint16_t>> inputs{"inputs", 3};
   // Merged buffer
   Output<Halide::Buffer<uint16_t>> output{"output", 2};
+  // Adds the 'telemetry' output described in align.h
+  GeneratorParam<bool> alignment_telemetry{"alignment_telemetry", false};
+  Output<Halide::Buffer<uint32_t>> *telemetry = nullptr;
+  // Uses the fixed-point temporal merge (see merge.h)
+  GeneratorParam<bool> fixed_point_merge{"fixed_point_merge", false};
+  // Uses the frequency-domain temporal merge (see merge.h); takes precedence
+  // over fixed_point_merge
+  GeneratorParam<bool> frequency_merge{"frequency_merge", false};
+  // Uses the sharpest frame of the burst as the reference instead of frame 0
+  GeneratorParam<bool> sharpest_reference{"sharpest_reference", false};
+
+  void configure() {
+    if (alignment_telemetry) {
+      telemetry = add_output<Halide::Buffer<uint32_t>>("telemetry", 2);
+    }
+  }
 
   void generate() {
-    Func alignment = align(inputs, inputs.width(), inputs.height());
-    Func merged = merge(inputs, inputs.width(), inputs.height(),
-                        inputs.dim(2).extent(), alignment);
+    Func imgs = inputs;
+    if (sharpest_reference) {
+      imgs = with_sharpest_reference(inputs, inputs.width(), inputs.height(),
+                                     inputs.dim(2).extent());
+    }
+    Func alignment;
+    if (alignment_telemetry) {
+      Func telemetry_func;
+      alignment = align(imgs, inputs.width(), inputs.height(),
+                        inputs.dim(2).extent(), telemetry_func);
+      *telemetry = telemetry_func;
+    } else {
+      alignment = align(imgs, inputs.width(), inputs.height());
+    }
+    Func merged =
+        frequency_merge
+            ? merge_frequency(imgs, inputs.width(), inputs.height(),
+                              inputs.dim(2).extent(), alignment)
+            : merge(imgs, inputs.width(), inputs.height(),
+                    inputs.dim(2).extent(), alignment, fixed_point_merge);
     output = merged;
   }
 };
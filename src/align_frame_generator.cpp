@@ -0,0 +1,61 @@
+#include <Halide.h>
+
+#include "Point.h"
+#include "align.h"
+
+namespace {
+
+class AlignFrame : public Halide::Generator<AlignFrame> {
+public:
+  // reference frame and the single alternate frame to align against it
+  Input<Halide::Buffer<uint16_t>> reference{"reference", 2};
+  Input<Halide::Buffer<uint16_t>> alternate{"alternate", 2};
+  // alignment offsets (tile_x, tile_y, c)
+  Output<Halide::Buffer<int16_t>> output{"output", 3};
+  // Searches every level of the pyramid over the full offset range, like
+  // align(), instead of around a seed. This is how the first alternate frame
+  // of a burst, which has no predecessor to seed it, is aligned.
+  GeneratorParam<bool> full_search{"full_search", false};
+  // seed offsets (tile_x, tile_y, c) where c = 0 is x and c = 1 is y; usually
+  // the output of this pipeline for the previous frame of the burst
+  Input<Halide::Buffer<int16_t>> *seed = nullptr;
+  // half-width of the search window at each searched pyramid level
+  Input<int> *search_radius = nullptr;
+
+  void configure() {
+    if (!full_search) {
+      seed = add_input<Halide::Buffer<int16_t>>("seed", 3);
+      search_radius = add_input<int>("search_radius");
+    }
+  }
+
+  void generate() {
+    Var x, y, n, tx, ty, c;
+
+    Func imgs("align_frame_inputs");
+    imgs(x, y, n) = Halide::mux(n, {reference(x, y), alternate(x, y)});
+
+    Func alignment;
+    if (full_search) {
+      alignment = align(imgs, reference.width(), reference.height());
+    } else {
+      Func seed_clamped = Halide::BoundaryConditions::repeat_edge(*seed);
+      Func seed_offsets("align_frame_seed");
+      seed_offsets(tx, ty, n) =
+          Halide::Tuple(seed_clamped(tx, ty, 0), seed_clamped(tx, ty, 1));
+
+      alignment = align_seeded(imgs, reference.width(), reference.height(),
+                               seed_offsets, *search_radius);
+    }
+
+    Point offset = P(alignment(tx, ty, 1));
+    output(tx, ty, c) = Halide::mux(c, {offset.x, offset.y});
+
+    output.dim(2).set_bounds(0, 2);
+    output.reorder(c, tx, ty).unroll(c).parallel(ty);
+  }
+};
+
+} // namespace
+
+HALIDE_REGISTER_GENERATOR(AlignFrame, align_frame)
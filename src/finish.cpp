@@ -7,57 +7,101 @@ using namespace Halide;
 using namespace Halide::ConciseCasts;
 
 /*
- * black_white_level -- Renormalizes an image based on input black and white
- * levels to take advantage of the full 16-bit integer depth. This is a
- * necessary step for camera white balance levels to be valid.
+ * normalize_raw -- Prepares a raw mosaicked image for demosaicking in one
+ * pointwise pass: shifts the CFA pattern to RG/GB, subtracts the black level
+ * and scales the white level to the full 16-bit range (which is necessary for
+ * camera white balance levels to be valid), and applies the white balance
+ * multiplier of each bayer site. Note that the two green channels in the
+ * bayer pattern are white-balanced separately. Unknown CFA patterns produce
+ * black.
  */
-Func black_white_level(Func input, const Expr bp, const Expr wp) {
+Func normalize_raw(Func input, Expr width, Expr height, Expr bp, Expr wp,
+                   const CompiletimeWhiteBalance &wb, Expr cfa_pattern) {
 
-  Func output("black_white_level_output");
+  Func output("normalize_raw_output");
 
   Var x, y;
 
+  // CFA shift: the same offset for every pixel, so a single dense load
+
+  Expr shift_x = cfa_pattern == int(CfaPattern::CFA_GRBG) ||
+                 cfa_pattern == int(CfaPattern::CFA_BGGR);
+  Expr shift_y = cfa_pattern == int(CfaPattern::CFA_GBRG) ||
+                 cfa_pattern == int(CfaPattern::CFA_BGGR);
+  Expr known_pattern = cfa_pattern >= int(CfaPattern::CFA_RGGB) &&
+                       cfa_pattern <= int(CfaPattern::CFA_GBRG);
+
+  Expr raw = select(known_pattern,
+                    input(x + select(shift_x, 1, 0), y + select(shift_y, 1, 0)),
+                    0);
+
+  // black-level subtraction and white-level scaling
+
   Expr white_factor = 65535.f / (wp - bp);
 
-  output(x, y) = u16_sat((i32(input(x, y)) - bp) * white_factor);
+  Expr level = u16_sat((i32(raw) - bp) * white_factor);
+
+  // white balance per bayer site
+
+  Expr R_row = y % 2 == 0;
+  Expr R_col = x % 2 == 0;
+
+  Expr gain = select(R_row && R_col, wb.r, R_row, wb.g0, R_col, wb.g1, wb.b);
+
+  // only whole bayer quads are white balanced, the rest is black
+
+  Expr in_quads = x < (width / 2) * 2 && y < (height / 2) * 2;
+
+  output(x, y) = select(in_quads, u16_sat(gain * f32(level)), u16(0));
+
+  ///////////////////////////////////////////////////////////////////////////
+  // schedule
+  ///////////////////////////////////////////////////////////////////////////
+
+  // with the quad unrolled the white balance gain is uniform per vector
+
+  output.compute_root()
+      .parallel(y)
+      .align_bounds(x, 2)
+      .unroll(x, 2)
+      .align_bounds(y, 2)
+      .unroll(y, 2)
+      .vectorize(x, 16);
 
   return output;
 }
 
 /*
- * white_balance -- Corrects white-balance of a mosaicked image based on input
- * color multipliers. Note that the two green channels in the bayer pattern
- * are white-balanced separately.
+ * bin_quads -- Bins each RG/GB quad of a bayer mosaic into one RGB pixel, in
+ * place of demosaicking: red and blue are the quad's red and blue samples and
+ * green is the rounded mean of its two greens. The output is a quarter of the
+ * pixels of the mosaic, so every later stage does a quarter of the work. If
+ * color_matrix is defined, it is applied as in demosaic.
  */
-Func white_balance(Func input, Expr width, Expr height,
-                   const CompiletimeWhiteBalance &wb) {
+Func bin_quads(Func input, Func color_matrix) {
 
-  Func output("white_balance_output");
+  Func output("bin_quads_output");
 
-  Var x, y;
-  RDom r(0, width / 2, 0, height / 2);
-
-  output(x, y) = u16(0);
+  Var x, y, c;
 
-  output(r.x * 2, r.y * 2) =
-      u16_sat(wb.r * f32(input(r.x * 2, r.y * 2))); // red
-  output(r.x * 2 + 1, r.y * 2) =
-      u16_sat(wb.g0 * f32(input(r.x * 2 + 1, r.y * 2))); // green 0
-  output(r.x * 2, r.y * 2 + 1) =
-      u16_sat(wb.g1 * f32(input(r.x * 2, r.y * 2 + 1))); // green 1
-  output(r.x * 2 + 1, r.y * 2 + 1) =
-      u16_sat(wb.b * f32(input(r.x * 2 + 1, r.y * 2 + 1))); // blue
+  Expr r = input(2 * x, 2 * y);
+  Expr g =
+      u16((u32(input(2 * x + 1, 2 * y)) + input(2 * x, 2 * y + 1) + 1) / 2);
+  Expr b = input(2 * x + 1, 2 * y + 1);
+
+  if (color_matrix.defined()) {
+    output(x, y, c) =
+        u16_sat(color_matrix(0, c) * f32(r) + color_matrix(1, c) * f32(g) +
+                color_matrix(2, c) * f32(b));
+  } else {
+    output(x, y, c) = mux(c, {r, g, b});
+  }
 
   ///////////////////////////////////////////////////////////////////////////
   // schedule
   ///////////////////////////////////////////////////////////////////////////
 
-  output.compute_root().parallel(y).vectorize(x, 16);
-
-  output.update(0).parallel(r.y);
-  output.update(1).parallel(r.y);
-  output.update(2).parallel(r.y);
-  output.update(3).parallel(r.y);
+  output.compute_root().bound(c, 0, 3).unroll(c).parallel(y).vectorize(x, 16);
 
   return output;
 }
@@ -66,32 +110,77 @@ Func white_balance(Func input, Expr width, Expr height,
  * demosaic -- Interpolates color channels in the bayer mosaic based on the
  * work of Malvar et al. Assumes that data is laid out in an RG/GB pattern.
  * https://www.microsoft.com/en-us/research/wp-content/uploads/2016/02/Demosaicing_ICASSP04.pdf
+ * The filters are written out tap by tap and the output is unrolled over the
+ * 2x2 bayer quad and the channels, so each site only evaluates the one filter
+ * it needs for each channel. The bilinear algorithm swaps the filters for
+ * plain averages of the nearest same-color neighbours, which is several times
+ * cheaper at the cost of softer edges and more color fringing. If
+ * color_matrix is defined, it is applied to the interpolated RGB in the same
+ * pass, strip by strip. The binned algorithm is bin_quads.
  */
-Func demosaic(Func input, Expr width, Expr height) {
-
-  Buffer<int32_t> f0(5, 5, "demosaic_f0"); // G at R locations; G at B locations
-  Buffer<int32_t> f1(5, 5, "demosaic_f1"); // R at green in R row, B column; B
-                                           // at green in B row, R column
-  Buffer<int32_t> f2(5, 5, "demosaic_f2"); // R at green in B row, R column; B
-                                           // at green in R row, B column
-  Buffer<int32_t> f3(5, 5, "demosaic_f3"); // R at blue in B row, B column; B at
-                                           // red in R row, R column
-
-  f0.translate({-2, -2});
-  f1.translate({-2, -2});
-  f2.translate({-2, -2});
-  f3.translate({-2, -2});
-
-  Func d0("demosaic_0");
-  Func d1("demosaic_1");
-  Func d2("demosaic_2");
-  Func d3("demosaic_3");
+Func demosaic(Func input, Expr width, Expr height, DemosaicAlgorithm algorithm,
+              Func color_matrix) {
+
+  if (algorithm == DemosaicAlgorithm::Binned) {
+    return bin_quads(input, color_matrix);
+  }
+
+  // f[0]: G at R locations; G at B locations
+  // f[1]: R at green in R row, B column; B at green in B row, R column
+  // f[2]: R at green in B row, R column; B at green in R row, B column
+  // f[3]: R at blue in B row, B column; B at red in R row, R column
+
+  const int malvar[4][5][5] = {{{0, 0, -1, 0, 0},
+                                {0, 0, 2, 0, 0},
+                                {-1, 2, 4, 2, -1},
+                                {0, 0, 2, 0, 0},
+                                {0, 0, -1, 0, 0}},
+                               {{0, 0, 1, 0, 0},
+                                {0, -2, 0, -2, 0},
+                                {-2, 8, 10, 8, -2},
+                                {0, -2, 0, -2, 0},
+                                {0, 0, 1, 0, 0}},
+                               {{0, 0, -2, 0, 0},
+                                {0, -2, 8, -2, 0},
+                                {1, 0, 10, 0, 1},
+                                {0, -2, 8, -2, 0},
+                                {0, 0, -2, 0, 0}},
+                               {{0, 0, -3, 0, 0},
+                                {0, 4, 0, 4, 0},
+                                {-3, 0, 12, 0, -3},
+                                {0, 4, 0, 4, 0},
+                                {0, 0, -3, 0, 0}}};
+  const int malvar_sums[4] = {8, 16, 16, 16};
+
+  const int bilinear[4][5][5] = {{{0, 0, 0, 0, 0},
+                                  {0, 0, 1, 0, 0},
+                                  {0, 1, 0, 1, 0},
+                                  {0, 0, 1, 0, 0},
+                                  {0, 0, 0, 0, 0}},
+                                 {{0, 0, 0, 0, 0},
+                                  {0, 0, 0, 0, 0},
+                                  {0, 1, 0, 1, 0},
+                                  {0, 0, 0, 0, 0},
+                                  {0, 0, 0, 0, 0}},
+                                 {{0, 0, 0, 0, 0},
+                                  {0, 0, 1, 0, 0},
+                                  {0, 0, 0, 0, 0},
+                                  {0, 0, 1, 0, 0},
+                                  {0, 0, 0, 0, 0}},
+                                 {{0, 0, 0, 0, 0},
+                                  {0, 1, 0, 1, 0},
+                                  {0, 0, 0, 0, 0},
+                                  {0, 1, 0, 1, 0},
+                                  {0, 0, 0, 0, 0}}};
+  const int bilinear_sums[4] = {4, 2, 2, 4};
+
+  const bool use_bilinear = algorithm == DemosaicAlgorithm::Bilinear;
+  const auto &f = use_bilinear ? bilinear : malvar;
+  const auto &f_sums = use_bilinear ? bilinear_sums : malvar_sums;
 
   Func output("demosaic_output");
 
   Var x, y, c;
-  RDom r0(-2, 5, -2, 5);
-  RDom r1(0, width / 2, 0, height / 2);
 
   // mirror input image with overlapping edges to keep mosaic pattern
   // consistency
@@ -99,72 +188,24 @@ Func demosaic(Func input, Expr width, Expr height) {
   Func input_mirror = BoundaryConditions::mirror_interior(
       input, {Range(0, width), Range(0, height)});
 
-  // demosaic filters
-
-  f0.fill(0);
-  f1.fill(0);
-  f2.fill(0);
-  f3.fill(0);
-
-  int f0_sum = 8;
-  int f1_sum = 16;
-  int f2_sum = 16;
-  int f3_sum = 16;
-
-  f0(0, -2) = -1;
-  f0(0, -1) = 2;
-  f0(-2, 0) = -1;
-  f0(-1, 0) = 2;
-  f0(0, 0) = 4;
-  f0(1, 0) = 2;
-  f0(2, 0) = -1;
-  f0(0, 1) = 2;
-  f0(0, 2) = -1;
-
-  f1(0, -2) = 1;
-  f1(-1, -1) = -2;
-  f1(1, -1) = -2;
-  f1(-2, 0) = -2;
-  f1(-1, 0) = 8;
-  f1(0, 0) = 10;
-  f1(1, 0) = 8;
-  f1(2, 0) = -2;
-  f1(-1, 1) = -2;
-  f1(1, 1) = -2;
-  f1(0, 2) = 1;
-
-  f2(0, -2) = -2;
-  f2(-1, -1) = -2;
-  f2(0, -1) = 8;
-  f2(1, -1) = -2;
-  f2(-2, 0) = 1;
-  f2(0, 0) = 10;
-  f2(2, 0) = 1;
-  f2(-1, 1) = -2;
-  f2(0, 1) = 8;
-  f2(1, 1) = -2;
-  f2(0, 2) = -2;
-
-  f3(0, -2) = -3;
-  f3(-1, -1) = 4;
-  f3(1, -1) = 4;
-  f3(-2, 0) = -3;
-  f3(0, 0) = 12;
-  f3(2, 0) = -3;
-  f3(-1, 1) = 4;
-  f3(1, 1) = 4;
-  f3(0, 2) = -3;
-
-  // intermediate demosaic functions
-
-  d0(x, y) = u16_sat(
-      sum(i32(input_mirror(x + r0.x, y + r0.y)) * f0(r0.x, r0.y)) / f0_sum);
-  d1(x, y) = u16_sat(
-      sum(i32(input_mirror(x + r0.x, y + r0.y)) * f1(r0.x, r0.y)) / f1_sum);
-  d2(x, y) = u16_sat(
-      sum(i32(input_mirror(x + r0.x, y + r0.y)) * f2(r0.x, r0.y)) / f2_sum);
-  d3(x, y) = u16_sat(
-      sum(i32(input_mirror(x + r0.x, y + r0.y)) * f3(r0.x, r0.y)) / f3_sum);
+  // demosaic filters, skipping the zero taps
+
+  auto filter = [&](int k) {
+    Expr total = 0;
+    for (int j = 0; j < 5; j++) {
+      for (int i = 0; i < 5; i++) {
+        if (f[k][j][i] != 0) {
+          total += i32(input_mirror(x + i - 2, y + j - 2)) * f[k][j][i];
+        }
+      }
+    }
+    return u16_sat(total / f_sums[k]);
+  };
+
+  Expr d0 = filter(0);
+  Expr d1 = filter(1);
+  Expr d2 = filter(2);
+  Expr d3 = filter(3);
 
   // resulting demosaicked function
 
@@ -176,28 +217,66 @@ Func demosaic(Func input, Expr width, Expr height) {
   Expr at_G = c == 1;
   Expr at_B = c == 2;
 
-  output(x, y, c) =
-      select(at_R && R_row && B_col, d1(x, y), at_R && B_row && R_col, d2(x, y),
-             at_R && B_row && B_col, d3(x, y), at_G && R_row && R_col, d0(x, y),
-             at_G && B_row && B_col, d0(x, y), at_B && B_row && R_col, d1(x, y),
-             at_B && R_row && B_col, d2(x, y), at_B && R_row && R_col, d3(x, y),
-             input(x, y));
+  Func rgb("demosaic_rgb");
+
+  rgb(x, y, c) = select(at_R && R_row && B_col, d1, at_R && B_row && R_col, d2,
+                        at_R && B_row && B_col, d3, at_G && R_row && R_col, d0,
+                        at_G && B_row && B_col, d0, at_B && B_row && R_col, d1,
+                        at_B && R_row && B_col, d2, at_B && R_row && R_col, d3,
+                        input(x, y));
+
+  // optional color transform, output(c) = sum_r color_matrix(r, c) * rgb(r)
+
+  if (color_matrix.defined()) {
+    Expr mixed = 0.f;
+    for (int r = 0; r < 3; r++) {
+      mixed += color_matrix(r, c) * f32(rgb(x, y, r));
+    }
+    output(x, y, c) = u16_sat(mixed);
+  } else {
+    output(x, y, c) = rgb(x, y, c);
+  }
 
   ///////////////////////////////////////////////////////////////////////////
   // schedule
   ///////////////////////////////////////////////////////////////////////////
-  d0.compute_root().parallel(y).vectorize(x, 16);
-  d1.compute_root().parallel(y).vectorize(x, 16);
-  d2.compute_root().parallel(y).vectorize(x, 16);
-  d3.compute_root().parallel(y).vectorize(x, 16);
 
-  output.compute_root()
-      .parallel(y)
-      .align_bounds(x, 2)
-      .unroll(x, 2)
-      .align_bounds(y, 2)
-      .unroll(y, 2)
-      .vectorize(x, 16);
+  // with the quad and the channel unrolled, the select conditions are
+  // constants and only the selected filter remains at each site
+
+  if (color_matrix.defined()) {
+    // demosaic strips of rows into a small buffer that the transform reads
+    // while it is still in cache
+
+    Var yo, yi;
+
+    rgb.compute_at(output, yo)
+        .bound(c, 0, 3)
+        .unroll(c)
+        .align_bounds(x, 2)
+        .unroll(x, 2)
+        .align_bounds(y, 2)
+        .unroll(y, 2)
+        .vectorize(x, 16);
+
+    output.compute_root()
+        .bound(c, 0, 3)
+        .split(y, yo, yi, 8)
+        .reorder(x, yi, c, yo)
+        .unroll(c)
+        .parallel(yo)
+        .vectorize(x, 16);
+  } else {
+    output.compute_root()
+        .bound(c, 0, 3)
+        .unroll(c)
+        .parallel(y)
+        .align_bounds(x, 2)
+        .unroll(x, 2)
+        .align_bounds(y, 2)
+        .unroll(y, 2)
+        .vectorize(x, 16);
+  }
   return output;
 }
 
@@ -276,8 +355,9 @@ Func bilateral_filter(Func input, Expr width, Expr height) {
   Func input_mirror = BoundaryConditions::mirror_interior(
       input, {Range(0, width), Range(0, height)});
 
-  Expr dist =
-      f32(i32(input_mirror(x, y, c)) - i32(input_mirror(x + dx, y + dy, c)));
+  Expr neighbour = yuv_to_f32(input_mirror(x + dx, y + dy, c));
+
+  Expr dist = f32(i32(yuv_to_f32(input_mirror(x, y, c))) - i32(neighbour));
 
   float sig2 = 100.f; // 2 * sigma ^ 2
 
@@ -285,8 +365,8 @@ Func bilateral_filter(Func input, Expr width, Expr height) {
 
   float threshold = 25000.f;
 
-  Expr score = select(abs(input_mirror(x + dx, y + dy, c)) > threshold, 0.f,
-                      exp(-dist * dist / sig2));
+  Expr score =
+      select(abs(neighbour) > threshold, 0.f, exp(-dist * dist / sig2));
 
   // combine score with gaussian weights and compute total weights in search
   // region
@@ -298,20 +378,19 @@ Func bilateral_filter(Func input, Expr width, Expr height) {
   // output normalizes weights to total weights
 
   bilateral(x, y, c) =
-      sum(input_mirror(x + r.x, y + r.y, c) * weights(r.x, r.y, x, y, c)) /
+      sum(yuv_to_f32(input_mirror(x + r.x, y + r.y, c)) *
+          weights(r.x, r.y, x, y, c)) /
       total_weights(x, y, c);
 
-  output(x, y, c) = f32(input(x, y, c));
+  output(x, y, c) = input(x, y, c);
 
-  output(x, y, 1) = bilateral(x, y, 1);
-  output(x, y, 2) = bilateral(x, y, 2);
+  output(x, y, 1) = yuv_from_f32(bilateral(x, y, 1), input.types()[0]);
+  output(x, y, 2) = yuv_from_f32(bilateral(x, y, 2), input.types()[0]);
 
   ///////////////////////////////////////////////////////////////////////////
   // schedule
   ///////////////////////////////////////////////////////////////////////////
 
-  // k.parallel(dy).parallel(dx).compute_root();
-
   weights.compute_at(output, y).vectorize(x, 16);
 
   output.compute_root().parallel(y).vectorize(x, 16);
@@ -322,12 +401,146 @@ Func bilateral_filter(Func input, Expr width, Expr height) {
   return output;
 }
 
+/*
+ * bilateral_grid -- Applies a joint bilateral filter to the UV channels of a
+ * YUV input to reduce chromatic noise, with the luma channel as the guide.
+ * The chroma is splatted into a bilateral grid (Chen et al. 2007) with a cell
+ * every 8 pixels and 1/16 of the luma range, blurred there and sliced back
+ * with trilinear interpolation, so the cost barely depends on the extent of
+ * the filter. Chroma values above a threshold are weighted as 0 to decrease
+ * amplification of saturation artifacts, which can occur around bright
+ * highlights. This is a much stronger filter than bilateral_filter, not a
+ * faster equivalent: its spatial support is about 8 to 11 pixels against 3,
+ * and chroma edges without a luma edge are blurred.
+ */
+Func bilateral_grid(Func input, Expr width, Expr height) {
+
+  Func histogram("bilateral_grid_histogram");
+  Func blurz("bilateral_grid_blurz");
+  Func blurx("bilateral_grid_blurx");
+  Func blury("bilateral_grid_blury");
+  Func interpolated("bilateral_grid_interpolated");
+  Func output("bilateral_grid_output");
+
+  Var x, y, z, c;
+
+  const int s_sigma = 8;          // pixels per grid cell
+  const float r_sigma = 1.f / 16; // luma per grid cell, in units of full scale
+
+  float threshold = 25000.f;
+
+  Func input_clamped = BoundaryConditions::repeat_edge(
+      input, {Range(0, width), Range(0, height)});
+
+  // splat: every pixel adds its weighted chroma and its weight to the cell of
+  // its position and luma. Grid channels 0 and 1 hold U and its weight, 2 and
+  // 3 hold V and its weight
+
+  RDom r(0, s_sigma, 0, s_sigma);
+
+  Expr sx = x * s_sigma + r.x - s_sigma / 2;
+  Expr sy = y * s_sigma + r.y - s_sigma / 2;
+
+  Expr luma = clamp(yuv_to_f32(input_clamped(sx, sy, 0)) / 65535.f, 0.f, 1.f);
+  Expr chroma = yuv_to_f32(input_clamped(sx, sy, c / 2 + 1));
+  Expr weight = select(abs(chroma) > threshold, 0.f, 1.f);
+
+  histogram(x, y, z, c) = 0.f;
+  histogram(x, y, i32(luma / r_sigma + 0.5f), c) +=
+      select(c % 2 == 0, weight * chroma, weight);
+
+  // blur the grid along each axis
+
+  blurz(x, y, z, c) = histogram(x, y, z - 2, c) +
+                      4 * histogram(x, y, z - 1, c) +
+                      6 * histogram(x, y, z, c) +
+                      4 * histogram(x, y, z + 1, c) + histogram(x, y, z + 2, c);
+  blurx(x, y, z, c) = blurz(x - 2, y, z, c) + 4 * blurz(x - 1, y, z, c) +
+                      6 * blurz(x, y, z, c) + 4 * blurz(x + 1, y, z, c) +
+                      blurz(x + 2, y, z, c);
+  blury(x, y, z, c) = blurx(x, y - 2, z, c) + 4 * blurx(x, y - 1, z, c) +
+                      6 * blurx(x, y, z, c) + 4 * blurx(x, y + 1, z, c) +
+                      blurx(x, y + 2, z, c);
+
+  // slice: trilinear interpolation of the grid at each pixel's position and
+  // luma
+
+  Expr zv = clamp(yuv_to_f32(input(x, y, 0)) / 65535.f, 0.f, 1.f) / r_sigma;
+  Expr zi = i32(zv);
+  Expr zf = zv - zi;
+  Expr xi = x / s_sigma, yi = y / s_sigma;
+  Expr xf = f32(x % s_sigma) / s_sigma;
+  Expr yf = f32(y % s_sigma) / s_sigma;
+
+  auto bilinear = [&](Expr z) {
+    return lerp(lerp(blury(xi, yi, z, c), blury(xi + 1, yi, z, c), xf),
+                lerp(blury(xi, yi + 1, z, c), blury(xi + 1, yi + 1, z, c), xf),
+                yf);
+  };
+
+  interpolated(x, y, c) = lerp(bilinear(zi), bilinear(zi + 1), zf);
+
+  // normalize by the interpolated weights; keep the input where no weight
+  // was splatted
+
+  auto normalized = [&](int k) {
+    Expr total = interpolated(x, y, 2 * k - 1);
+    return select(total > 0.f, interpolated(x, y, 2 * k - 2) / total,
+                  yuv_to_f32(input(x, y, k)));
+  };
+
+  output(x, y, c) = yuv_from_f32(select(c == 1, normalized(1), c == 2,
+                                        normalized(2),
+                                        yuv_to_f32(input(x, y, c))),
+                                 input.types()[0]);
+
+  ///////////////////////////////////////////////////////////////////////////
+  // schedule
+  ///////////////////////////////////////////////////////////////////////////
+
+  histogram.compute_at(blurz, y);
+  histogram.update().reorder(c, r.x, r.y, x, y).unroll(c);
+
+  blurz.compute_root()
+      .bound(c, 0, 4)
+      .reorder(c, z, x, y)
+      .parallel(y)
+      .vectorize(x, 8)
+      .unroll(c);
+  blurx.compute_root()
+      .bound(c, 0, 4)
+      .reorder(c, x, y, z)
+      .parallel(z)
+      .vectorize(x, 8)
+      .unroll(c);
+  blury.compute_root()
+      .bound(c, 0, 4)
+      .reorder(c, x, y, z)
+      .parallel(z)
+      .vectorize(x, 8)
+      .unroll(c);
+
+  interpolated.compute_at(output, y).bound(c, 0, 4).unroll(c).vectorize(x, 8);
+
+  output.compute_root()
+      .bound(c, 0, 3)
+      .reorder(c, x, y)
+      .unroll(c)
+      .parallel(y)
+      .vectorize(x, 16);
+
+  return output;
+}
+
 /*
  * desaturate_noise -- Reduces chromatic noise by blurring UV channels of a YUV
  * input in and using the result only if it falls within constraints on by what
- * factor and absolute threshold the chroma magnitudes fall.
+ * factor and absolute threshold the chroma magnitudes fall. With recursive_blur
+ * the two 15x15 blurs are replaced by one recursive blur of the same total
+ * std deviation, whose cost does not depend on it.
  */
-Func desaturate_noise(Func input, Expr width, Expr height) {
+Func desaturate_noise(Func input, Expr width, Expr height,
+                      bool recursive_blur) {
 
   Func output("desaturate_noise_output");
 
@@ -336,8 +549,16 @@ Func desaturate_noise(Func input, Expr width, Expr height) {
   Func input_mirror = BoundaryConditions::mirror_image(
       input, {Range(0, width), Range(0, height)});
 
-  Func blur = gauss_15x15(gauss_15x15(input_mirror, "desaturate_noise_blur1"),
-                          "desaturate_noise_blur2");
+  Func blur;
+
+  if (recursive_blur) {
+    float sigma = 8.f / 3.f * std::sqrt(2.f); // two passes of std dev 8/3
+    blur = gauss_iir(input_mirror, sigma, width, height,
+                     "desaturate_noise_blur");
+  } else {
+    blur = gauss_15x15(gauss_15x15(input_mirror, "desaturate_noise_blur1"),
+                       "desaturate_noise_blur2");
+  }
 
   // magnitude of chroma channel can increase by at most the factor
 
@@ -348,17 +569,20 @@ Func desaturate_noise(Func input, Expr width, Expr height) {
 
   float threshold = 25000.f;
 
+  auto denoised = [&](int k) {
+    Expr in = yuv_to_f32(input(x, y, k));
+    Expr blurred = yuv_to_f32(blur(x, y, k));
+    Expr value = select((abs(blurred) / abs(in) < factor) &&
+                            (abs(in) < threshold) && (abs(blurred) < threshold),
+                        .7f * blurred + .3f * in, in);
+    return yuv_from_f32(value, input.types()[0]);
+  };
+
   output(x, y, c) = input(x, y, c);
 
-  output(x, y, 1) = select(
-      (abs(blur(x, y, 1)) / abs(input(x, y, 1)) < factor) &&
-          (abs(input(x, y, 1)) < threshold) && (abs(blur(x, y, 1)) < threshold),
-      .7f * blur(x, y, 1) + .3f * input(x, y, 1), input(x, y, 1));
+  output(x, y, 1) = denoised(1);
 
-  output(x, y, 2) = select(
-      (abs(blur(x, y, 2)) / abs(input(x, y, 2)) < factor) &&
-          (abs(input(x, y, 2)) < threshold) && (abs(blur(x, y, 2)) < threshold),
-      .7f * blur(x, y, 2) + .3f * input(x, y, 2), input(x, y, 2));
+  output(x, y, 2) = denoised(2);
 
   ///////////////////////////////////////////////////////////////////////////
   // schedule
@@ -378,7 +602,8 @@ Func increase_saturation(Func input, float strength) {
 
   Var x, y, c;
 
-  output(x, y, c) = strength * input(x, y, c);
+  output(x, y, c) =
+      yuv_from_f32(strength * yuv_to_f32(input(x, y, c)), input.types()[0]);
   output(x, y, 0) = input(x, y, 0);
 
   ///////////////////////////////////////////////////////////////////////////
@@ -394,21 +619,27 @@ Func increase_saturation(Func input, float strength) {
  * chroma_denoise -- Reduces chromatic noise in an image through a combination
  * bilateral filtering and shadow desaturation. The noise removal algorithms
  * will be applied iteratively in order of increasing aggressiveness, with the
- * total number of passes determined by input.
+ * total number of passes determined by input. recursive_blur selects the
+ * recursive blur for the desaturation passes, fixed_point_yuv the i16 YUV
+ * representation (see rgb_to_yuv) and bilateral_on_grid bilateral_grid for
+ * the first pass instead of the 7x7 bilateral_filter.
  */
-Func chroma_denoise(Func input, Expr width, Expr height, int num_passes) {
+Func chroma_denoise(Func input, Expr width, Expr height, int num_passes,
+                    bool recursive_blur, bool fixed_point_yuv,
+                    bool bilateral_on_grid) {
 
-  Func output = rgb_to_yuv(input);
+  Func output = rgb_to_yuv(input, fixed_point_yuv);
 
   int pass = 0;
 
   if (num_passes > 0)
-    output = bilateral_filter(output, width, height);
+    output = bilateral_on_grid ? bilateral_grid(output, width, height)
+                               : bilateral_filter(output, width, height);
   pass++;
 
   while (pass < num_passes) {
 
-    output = desaturate_noise(output, width, height);
+    output = desaturate_noise(output, width, height, recursive_blur);
     pass++;
   }
 
@@ -535,19 +766,33 @@ Func brighten(Func input, Expr gain) {
 }
 
 /*
- * tone_map -- Iteratively compresses the dynamic range and boosts the gain
- * of the input. Compression and gain are determined by input and are applied
- * with an increasing strength in each iteration to ensure a natural looking
- * dynamic range compression.
+ * specialize_on -- Specializes stage on every combination of the defined
+ * enables (boolean parameters), in order. In each branch the selects on the
+ * enables fold away, so the stage reads only the producers they pick and the
+ * others are skipped. Call it once the stage is scheduled.
+ */
+void specialize_on(Stage stage, const std::vector<Expr> &enables,
+                   size_t first = 0) {
+  if (first == enables.size()) {
+    return;
+  }
+  if (enables[first].defined()) {
+    specialize_on(stage.specialize(enables[first]), enables, first + 1);
+  }
+  specialize_on(stage, enables, first + 1);
+}
+
+/*
+ * fuse_exposures -- The iterative exposure fusion of tone_map, applied to a
+ * grayscale image in num_passes passes. Returns the tone mapped grayscale
+ * image.
  */
-Func tone_map(Func input, Expr width, Expr height, Expr comp, Expr gain) {
+Func fuse_exposures(Func grayscale, Expr width, Expr height, Expr comp,
+                    Expr gain, int num_passes) {
 
   Func normal_dist("luma_weight_distribution");
-  Func grayscale("grayscale");
-  Func output("tone_map_output");
 
-  Var x, y, c, v;
-  RDom r(0, 3);
+  Var v;
 
   // distribution function (from exposure fusion paper)
 
@@ -555,8 +800,6 @@ Func tone_map(Func input, Expr width, Expr height, Expr comp, Expr gain) {
 
   // use grayscale and brighter grayscale images for exposure fusion
 
-  grayscale(x, y) = u16(sum(u32(input(x, y, r))) / 3);
-
   Func bright, dark;
 
   dark = grayscale;
@@ -564,22 +807,21 @@ Func tone_map(Func input, Expr width, Expr height, Expr comp, Expr gain) {
   // more passes and smaller compression and gain values produces more natural
   // results
 
-  int num_passes = 3;
-
   // constants used to determine compression and gain values at each iteration
 
   Expr comp_const = 1.f + comp / num_passes;
   Expr gain_const = 1.f + gain / num_passes;
 
-  Expr comp_slope = (comp - comp_const) / (num_passes - 1);
-  Expr gain_slope = (gain - gain_const) / (num_passes - 1);
+  Expr comp_slope = (comp - comp_const) / std::max(1, num_passes - 1);
+  Expr gain_slope = (gain - gain_const) / std::max(1, num_passes - 1);
 
   for (int pass = 0; pass < num_passes; pass++) {
 
-    // compute compression and gain at given iteration
+    // compute compression and gain at given iteration; a single pass applies
+    // them in full
 
-    Expr norm_comp = pass * comp_slope + comp_const;
-    Expr norm_gain = pass * gain_slope + gain_const;
+    Expr norm_comp = num_passes > 1 ? pass * comp_slope + comp_const : comp;
+    Expr norm_gain = num_passes > 1 ? pass * gain_slope + gain_const : gain;
 
     bright = brighten(dark, norm_comp);
 
@@ -595,6 +837,166 @@ Func tone_map(Func input, Expr width, Expr height, Expr comp, Expr gain) {
     dark = brighten(gamma_inverse(dark_gamma), norm_gain);
   }
 
+  ///////////////////////////////////////////////////////////////////////////
+  // schedule
+  ///////////////////////////////////////////////////////////////////////////
+
+  normal_dist.compute_root().vectorize(v, 16);
+
+  return dark;
+}
+
+/*
+ * guided_upsample -- Upsamples target_small, a filtered version of
+ * guide_small, to the resolution of guide by a factor of factor. Fits the
+ * local affine model target = a * guide + b on the small images (a guided
+ * filter with a (2 * radius + 1)^2 window) and applies the bilinearly
+ * upsampled a and b to the full resolution guide, so edges of the guide stay
+ * sharp. He and Sun, "Fast Guided Filter", 2015.
+ */
+Func guided_upsample(Func guide_small, Func target_small, Func guide,
+                     Expr small_width, Expr small_height, int factor) {
+
+  Func moments("guided_moments");
+  Func coeffs("guided_coeffs");
+  Func coeffs_mean("guided_coeffs_mean");
+  Func output("guided_upsample_output");
+
+  Var x, y;
+
+  const int radius = 2;
+  const float area = (2 * radius + 1) * (2 * radius + 1);
+  const float eps = 1e-4f; // regularizes a in flat regions
+
+  RDom r(-radius, 2 * radius + 1, -radius, 2 * radius + 1);
+
+  Range x_range(0, small_width), y_range(0, small_height);
+  Func guide_mirror =
+      BoundaryConditions::repeat_edge(guide_small, {x_range, y_range});
+  Func target_mirror =
+      BoundaryConditions::repeat_edge(target_small, {x_range, y_range});
+
+  // window sums of g, t, g * g and g * t, in units of full scale
+
+  Expr g = f32(guide_mirror(x + r.x, y + r.y)) / 65535.f;
+  Expr t = f32(target_mirror(x + r.x, y + r.y)) / 65535.f;
+
+  moments(x, y) = {0.f, 0.f, 0.f, 0.f};
+  moments(x, y) = {moments(x, y)[0] + g, moments(x, y)[1] + t,
+                   moments(x, y)[2] + g * g, moments(x, y)[3] + g * t};
+
+  // least squares fit of the affine model in each window
+
+  Expr mean_g = moments(x, y)[0] / area;
+  Expr mean_t = moments(x, y)[1] / area;
+  Expr var_g = moments(x, y)[2] / area - mean_g * mean_g;
+  Expr cov_gt = moments(x, y)[3] / area - mean_g * mean_t;
+
+  Expr a = cov_gt / (var_g + eps);
+
+  coeffs(x, y) = {a, mean_t - a * mean_g};
+
+  // average the models of all windows covering each pixel
+
+  coeffs_mean(x, y) = {0.f, 0.f};
+  coeffs_mean(x, y) = {
+      coeffs_mean(x, y)[0] + coeffs(x + r.x, y + r.y)[0] / area,
+      coeffs_mean(x, y)[1] + coeffs(x + r.x, y + r.y)[1] / area};
+
+  // bilinearly upsample the model and apply it to the guide
+
+  Expr sx = (x + 0.5f) / factor - 0.5f;
+  Expr sy = (y + 0.5f) / factor - 0.5f;
+  Expr ix = i32(floor(sx)), iy = i32(floor(sy));
+  Expr fx = sx - ix, fy = sy - iy;
+
+  auto upsampled = [&](int k) {
+    Expr top = lerp(coeffs_mean(ix, iy)[k], coeffs_mean(ix + 1, iy)[k], fx);
+    Expr bot =
+        lerp(coeffs_mean(ix, iy + 1)[k], coeffs_mean(ix + 1, iy + 1)[k], fx);
+    return lerp(top, bot, fy);
+  };
+
+  output(x, y) = u16_sat(
+      65535.f * (upsampled(0) * (f32(guide(x, y)) / 65535.f) + upsampled(1)));
+
+  ///////////////////////////////////////////////////////////////////////////
+  // schedule
+  ///////////////////////////////////////////////////////////////////////////
+
+  moments.compute_root().parallel(y).vectorize(x, 8);
+  moments.update().parallel(y).vectorize(x, 8);
+
+  coeffs.compute_root().parallel(y).vectorize(x, 8);
+
+  coeffs_mean.compute_root().parallel(y).vectorize(x, 8);
+  coeffs_mean.update().parallel(y).vectorize(x, 8);
+
+  output.compute_root().parallel(y).vectorize(x, 16);
+
+  return output;
+}
+
+/*
+ * tone_map -- Iteratively compresses the dynamic range and boosts the gain
+ * of the input. Compression and gain are determined by input and are applied
+ * with an increasing strength in each iteration to ensure a natural looking
+ * dynamic range compression. With downsample > 1 the fusion runs on a
+ * grayscale image downsampled by that factor and its result is brought back
+ * to full resolution with a guided upsampling. If multi_pass is defined, the
+ * fusion is also computed in a single pass and the output selects between
+ * the two, so its consumers must be specialized on multi_pass to skip the
+ * other; otherwise it always takes three passes. The grayscale image, the
+ * one stage reading input, is specialized on input_enables.
+ */
+Func tone_map(Func input, Expr width, Expr height, Expr comp, Expr gain,
+              int downsample, Expr multi_pass,
+              const std::vector<Expr> &input_enables) {
+
+  Func grayscale("grayscale");
+  Func output("tone_map_output");
+
+  Var x, y, c;
+  RDom r(0, 3);
+
+  grayscale(x, y) = u16(sum(u32(input(x, y, r))) / 3);
+
+  Func grayscale_small("grayscale_small");
+
+  Expr small_width = width / downsample;
+  Expr small_height = height / downsample;
+
+  if (downsample > 1) {
+    RDom rd(0, downsample, 0, downsample);
+
+    grayscale_small(x, y) =
+        u16(sum(u32(grayscale(x * downsample + rd.x, y * downsample + rd.y))) /
+            (downsample * downsample));
+  }
+
+  // the fused grayscale image at full resolution, for num_passes passes
+
+  auto fused = [&](int num_passes) {
+    if (downsample == 1) {
+      return fuse_exposures(grayscale, width, height, comp, gain, num_passes);
+    }
+
+    Func dark_small = fuse_exposures(grayscale_small, small_width,
+                                     small_height, comp, gain, num_passes);
+
+    return guided_upsample(grayscale_small, dark_small, grayscale,
+                           small_width, small_height, downsample);
+  };
+
+  Func dark = fused(3);
+
+  if (multi_pass.defined()) {
+    Func multi = dark;
+    Func single = fused(1);
+    dark = Func("tone_map_passes");
+    dark(x, y) = select(multi_pass, multi(x, y), single(x, y));
+  }
+
   // reintroduce image color
 
   output(x, y, c) =
@@ -605,8 +1007,11 @@ Func tone_map(Func input, Expr width, Expr height, Expr comp, Expr gain) {
   ///////////////////////////////////////////////////////////////////////////
 
   grayscale.compute_root().parallel(y).vectorize(x, 16);
+  specialize_on(grayscale, input_enables);
 
-  normal_dist.compute_root().vectorize(v, 16);
+  if (downsample > 1) {
+    grayscale_small.compute_root().parallel(y).vectorize(x, 16);
+  }
 
   return output;
 }
@@ -637,40 +1042,48 @@ Func srgb(Func input, Func srgb_matrix) {
 }
 
 /*
- * contrast -- Boosts the global contrast of an image with an S-shaped
- * scaled cosine curve followed by black level subtraction and renormalization.
+ * contrast_curve -- The pointwise u16 -> u16 curve of contrast.
  */
-Func contrast(Func input, float strength, int black_level) {
-
-  Func output("contrast_output");
-
-  Var x, y, c;
+Expr contrast_curve(Expr input, Expr strength, int black_level) {
 
   // scale stretches the curve horizontally, decreasing the amount of contrast
 
-  float scale = 0.8f + 0.3f / std::min(1.f, strength);
+  Expr scale = 0.8f + 0.3f / min(1.f, strength);
 
   // constants for scaling cosine curve to the domain/range of image values
 
-  float inner_constant = 3.141592f / (2.f * scale);
-  float sin_constant = sin(inner_constant);
+  Expr inner_constant = 3.141592f / (2.f * scale);
+  Expr sin_constant = sin(inner_constant);
 
-  float slope = 65535.f / (2.f * sin_constant);
-  float constant = slope * sin_constant;
+  Expr slope = 65535.f / (2.f * sin_constant);
+  Expr constant = slope * sin_constant;
 
-  float factor = 3.141592f / (scale * 65535.f);
+  Expr factor = 3.141592f / (scale * 65535.f);
 
-  Expr val = factor * f32(input(x, y, c));
+  Expr val = factor * f32(input);
 
   // scaled cosine output produces S-shaped map over image values
 
-  output(x, y, c) = u16_sat(slope * sin(val - inner_constant) + constant);
+  Expr curved = u16_sat(slope * sin(val - inner_constant) + constant);
 
   // subtract black level and scale
 
   float white_scale = 65535.f / (65535.f - black_level);
 
-  output(x, y, c) = u16_sat((i32(output(x, y, c)) - black_level) * white_scale);
+  return u16_sat((i32(curved) - black_level) * white_scale);
+}
+
+/*
+ * contrast -- Boosts the global contrast of an image with an S-shaped
+ * scaled cosine curve followed by black level subtraction and renormalization.
+ */
+Func contrast(Func input, Expr strength, int black_level) {
+
+  Func output("contrast_output");
+
+  Var x, y, c;
+
+  output(x, y, c) = contrast_curve(input(x, y, c), strength, black_level);
 
   ///////////////////////////////////////////////////////////////////////////
   // schedule
@@ -684,8 +1097,12 @@ Func contrast(Func input, float strength, int black_level) {
 /*
  * sharpen -- Sharpens input using difference of Gaussian unsharp masking
  * applied only to the image luminance so as to not amplify chroma noise.
+ * fixed_point_yuv selects the i16 YUV representation (see rgb_to_yuv). The
+ * YUV conversion, the one stage reading input, is specialized on
+ * input_enables.
  */
-Func sharpen(Func input, float strength) {
+Func sharpen(Func input, Expr strength, bool fixed_point_yuv,
+             const std::vector<Expr> &input_enables) {
 
   Func output_yuv("sharpen_output_yuv");
 
@@ -693,7 +1110,8 @@ Func sharpen(Func input, float strength) {
 
   // convert to yuv
 
-  Func yuv_input = rgb_to_yuv(input);
+  Func yuv_input = rgb_to_yuv(input, fixed_point_yuv);
+  specialize_on(yuv_input, input_enables);
 
   // apply two gaussian passes
 
@@ -705,8 +1123,15 @@ Func sharpen(Func input, float strength) {
   Func difference_of_gauss = diff(small_blurred, large_blurred, "unsharp_DoG");
 
   output_yuv(x, y, c) = yuv_input(x, y, c);
-  output_yuv(x, y, 0) =
-      yuv_input(x, y, 0) + strength * difference_of_gauss(x, y, 0);
+  // the difference is in units of the samples, which are halved in fixed
+  // point
+
+  Expr detail_gain = fixed_point_yuv ? 2.f * strength : strength;
+
+  output_yuv(x, y, 0) = yuv_from_f32(
+      yuv_to_f32(yuv_input(x, y, 0)) +
+          detail_gain * f32(difference_of_gauss(x, y, 0)),
+      yuv_input.types()[0]);
 
   // convert back to rgb
 
@@ -744,15 +1169,112 @@ Func u8bit_interleaved(Func input) {
   return output;
 }
 
-Halide::Func shift_bayer_to_rggb(Halide::Func input,
-                                 const Halide::Expr cfa_pattern) {
-  Func output("rggb_input");
-  Var x, y, c;
-  output(x, y) =
-      select(cfa_pattern == int(CfaPattern::CFA_RGGB), input(x, y),
-             cfa_pattern == int(CfaPattern::CFA_GRBG), input(x + 1, y),
-             cfa_pattern == int(CfaPattern::CFA_GBRG), input(x, y + 1),
-             cfa_pattern == int(CfaPattern::CFA_BGGR), input(x + 1, y + 1), 0);
+/*
+ * tone_curve_table -- contrast(gamma_correct(v)) of every u16 value v, as a
+ * function of v. Left unscheduled.
+ */
+Func tone_curve_table(Expr strength, int black_level) {
+
+  Func linear("tone_curve_linear");
+  Func table("tone_curve_table");
+
+  Var x, y, v;
+
+  linear(x, y) = u16(x);
+
+  Func gamma = gamma_correct(linear);
+
+  table(v) = contrast_curve(gamma(v, 0), strength, black_level);
+
+  return table;
+}
+
+/*
+ * tone_curve_interleaved -- Equivalent to
+ * u8bit_interleaved(contrast(gamma_correct(input), strength, black_level)) in
+ * a single pass. The three pointwise maps are composed into one 65536 entry
+ * u16 -> u8 table, computed at the start of the pipeline with the same
+ * expressions, which is then gathered per sample. With bits = 16 the table
+ * is u16 -> u16 and the output is contrast(gamma_correct(input)), interleaved.
+ */
+Func tone_curve_interleaved(Func input, Expr strength, int black_level,
+                            int bits) {
+
+  Func curve("tone_curve");
+  Func output("tone_curve_interleaved_output");
+
+  Var c, x, y, v;
+
+  // the table: every u16 value through the gamma and contrast curves
+
+  Func table = tone_curve_table(strength, black_level);
+
+  if (bits == 16) {
+    curve(v) = table(v);
+  } else {
+    curve(v) = u8_sat(table(v) / 256);
+  }
+
+  output(c, x, y) = curve(i32(input(x, y, c)));
+
+  ///////////////////////////////////////////////////////////////////////////
+  // schedule
+  ///////////////////////////////////////////////////////////////////////////
+
+  curve.compute_root().bound(v, 0, 65536).vectorize(v, 16);
+
+  output.compute_root().bound(c, 0, 3).unroll(c).parallel(y).vectorize(x, 16);
+
+  return output;
+}
+
+/*
+ * sharpen_interleaved -- tone_curve_interleaved, sharpened when enable (a
+ * boolean parameter) is true at run time: the tone curve is then applied at
+ * 16 bits, and the output of sharpen is converted to bits bits. The output
+ * is specialized on enable, so a disabled sharpen is skipped, and on
+ * input_enables like the stages of sharpen that read input.
+ */
+Func sharpen_interleaved(Func input, Expr width, Expr height,
+                         Expr contrast_strength, int black_level, Expr enable,
+                         Expr sharpen_strength, int bits,
+                         const std::vector<Expr> &input_enables) {
+
+  Func toned("sharpen_input");
+  Func output("sharpen_interleaved_output");
+
+  Var c, x, y;
+
+  Func curve = tone_curve_table(contrast_strength, black_level);
+
+  toned(x, y, c) = curve(i32(input(x, y, c)));
+
+  Func sharpened = sharpen(BoundaryConditions::repeat_edge(
+                               toned, {Range(0, width), Range(0, height)}),
+                           sharpen_strength, false, input_enables);
+
+  // u8_sat(table / 256) is the 8-bit table of tone_curve_interleaved
+
+  auto convert = [&](Expr value) {
+    return bits == 16 ? value : u8_sat(value / 256);
+  };
+
+  output(c, x, y) =
+      select(enable, convert(sharpened(x, y, c)), convert(toned(x, y, c)));
+
+  ///////////////////////////////////////////////////////////////////////////
+  // schedule
+  ///////////////////////////////////////////////////////////////////////////
+
+  curve.compute_root().bound(curve.args()[0], 0, 65536).vectorize(
+      curve.args()[0], 16);
+
+  output.compute_root().bound(c, 0, 3).unroll(c).parallel(y).vectorize(x, 16);
+
+  std::vector<Expr> enables = {enable};
+  enables.insert(enables.end(), input_enables.begin(), input_enables.end());
+  specialize_on(output, enables);
+
   return output;
 }
 
@@ -762,62 +1284,137 @@ Halide::Func shift_bayer_to_rggb(Halide::Func input,
  * Input pecifies black-level, white-level and white balance. Additionally,
  * tone mapping is applied to the image, as specified by the input compression
  * and gain amounts. This produces natural-looking brightened shadows, without
- * blowing out highlights. The output values are 8-bit.
+ * blowing out highlights. The output values are 8-bit. Of the options
+ * (FinishOptions), demosaic_algorithm trades demosaic quality for speed, and
+ * Binned also halves the output width and height; tone_map_downsample > 1
+ * computes the tone mapping at reduced resolution. fold_color_matrix applies
+ * the white balance gains and the color matrix as one 3x3 transform in the
+ * demosaic pass instead of before and after it. This moves chroma denoising
+ * after the color matrix, onto linear sRGB instead of white balanced camera
+ * RGB, which changes its result slightly: the denoise filters the chroma of
+ * any linear RGB, and splitting the matrix around it would give back the
+ * pass the fold saves. stages enables chroma denoising, sharpening and
+ * multi-pass tone mapping per job (see FinishStages). output_format selects
+ * 16-bit output instead, display-referred or linear; the linear output skips
+ * gamma correction, contrast and sharpening.
  */
 Halide::Func finish(Halide::Func input, Expr width, Expr height, Expr bp,
                     Expr wp, const CompiletimeWhiteBalance &wb,
                     const Expr cfa_pattern, Halide::Func ccm, const Expr c,
-                    const Expr g) {
+                    const Expr g, const FinishOptions &options) {
+  const FinishStages &stages = options.stages;
   int denoise_passes = 1;
-  float contrast_strength = 5.f;
+  Expr contrast_strength = stages.contrast_strength.defined()
+                               ? stages.contrast_strength
+                               : Expr(5.f);
   int black_level = 2000;
-  float sharpen_strength = 2.f;
-
-  Func bayer_shifted = shift_bayer_to_rggb(input, cfa_pattern);
-
-  // 1. Black-level subtraction and white-level scaling
-  Func black_white_level_output = black_white_level(bayer_shifted, bp, wp);
+  Expr sharpen_strength = stages.sharpen_strength.defined()
+                              ? stages.sharpen_strength
+                              : Expr(2.f);
+
+  // with fold_color_matrix only the two greens are balanced (to each other)
+  // on the mosaic; the red, green and blue gains are folded into the color
+  // matrix, which is applied as part of the demosaic
+
+  Func color_matrix;
+  CompiletimeWhiteBalance mosaic_wb = wb;
+
+  if (options.fold_color_matrix) {
+    Var r, c;
+    color_matrix = Func("folded_color_matrix");
+    color_matrix(r, c) =
+        ccm(r, c) * select(r == 0, wb.r, r == 1, wb.g0, wb.b);
+    color_matrix.compute_root();
+    mosaic_wb = CompiletimeWhiteBalance{1.f, 1.f, wb.g1 / wb.g0, 1.f};
+  }
 
-  // 2. White balancing
+  // 1.-2. CFA shift, black-level subtraction, white-level scaling and white
+  // balancing
 
   Func white_balance_output =
-      white_balance(black_white_level_output, width, height, wb);
+      normalize_raw(input, width, height, bp, wp, mosaic_wb, cfa_pattern);
 
   // 3. Demosaicking
 
-  Func demosaic_output = demosaic(white_balance_output, width, height);
+  Func demosaic_output = demosaic(white_balance_output, width, height,
+                                  options.demosaic_algorithm, color_matrix);
+
+  // binning leaves one pixel per quad for the remaining stages
 
-  // 4. Chroma denoising
+  if (options.demosaic_algorithm == DemosaicAlgorithm::Binned) {
+    width = width / 2;
+    height = height / 2;
+  }
+
+  // 4. Chroma denoising, if enabled; the stages reading the selection below
+  // are specialized on the enable, so the branch not taken is skipped
 
-  Func chroma_denoised_output =
-      chroma_denoise(demosaic_output, width, height, denoise_passes);
+  Func chroma_denoised_output = demosaic_output;
+
+  if (stages.chroma_denoise.defined()) {
+    Func denoised =
+        chroma_denoise(demosaic_output, width, height, denoise_passes);
+    Var x, y, ch;
+    chroma_denoised_output = Func("chroma_denoise_select");
+    chroma_denoised_output(x, y, ch) = select(
+        stages.chroma_denoise, denoised(x, y, ch), demosaic_output(x, y, ch));
+  }
 
-  // 5. sRGB color correction
+  // 5. sRGB color correction; when folded it already happened in the
+  // demosaic, so chroma denoising above ran on sRGB (see finish.h)
 
-  Func srgb_output = srgb(demosaic_output, ccm);
+  Func srgb_output = options.fold_color_matrix
+                         ? chroma_denoised_output
+                         : srgb(chroma_denoised_output, ccm);
 
   // 6. Tone mapping
 
-  Func tone_map_output = tone_map(srgb_output, width, height, c, g);
+  Func tone_map_output =
+      tone_map(srgb_output, width, height, c, g, options.tone_map_downsample,
+               stages.multi_pass_tone_map, {stages.chroma_denoise});
 
-  // 7. Gamma correction
+  // the selections of steps 4 and 6 are read by the final stage
 
-  Func gamma_correct_output = gamma_correct(tone_map_output);
+  const std::vector<Expr> enables = {stages.chroma_denoise,
+                                     stages.multi_pass_tone_map};
 
-  // 8. Global contrast increase
+  // linear output stops at the tone mapping
 
-  Func contrast_output =
-      contrast(gamma_correct_output, contrast_strength, black_level);
+  if (options.output_format == OutputFormat::U16Linear) {
+    Func linear_output("linear_interleaved_output");
+    Var x, y, ch;
+    linear_output(ch, x, y) = tone_map_output(x, y, ch);
+    linear_output.compute_root()
+        .bound(ch, 0, 3)
+        .unroll(ch)
+        .parallel(y)
+        .vectorize(x, 16);
+    specialize_on(linear_output, enables);
+    return linear_output;
+  }
+
+  // 7. Gamma correction, global contrast increase and conversion to 8 bits
+  // (unless the output is 16 bits), fused into a single tone curve
 
-  // 9. Sharpening
+  int bits = options.output_format == OutputFormat::U16 ? 16 : 8;
+
+  if (!stages.sharpen.defined()) {
+    Func output = tone_curve_interleaved(tone_map_output, contrast_strength,
+                                         black_level, bits);
+    specialize_on(output, enables);
+    return output;
+  }
 
-  Func sharpen_output = sharpen(contrast_output, sharpen_strength);
+  // 8. The same with sharpening, if enabled, before the conversion
 
-  return u8bit_interleaved(contrast_output);
+  return sharpen_interleaved(tone_map_output, width, height, contrast_strength,
+                             black_level, stages.sharpen, sharpen_strength,
+                             bits, enables);
 }
 
 Func finish(Func input, int width, int height, const BlackPoint bp,
             const WhitePoint wp, const WhiteBalance &wb, const CfaPattern cfa,
-            Halide::Func ccm, const Compression c, const Gain g) {
-  return finish(input, width, height, bp, wp, wb, cfa, ccm, c, g);
+            Halide::Func ccm, const Compression c, const Gain g,
+            const FinishOptions &options) {
+  return finish(input, width, height, bp, wp, wb, cfa, ccm, c, g, options);
 }
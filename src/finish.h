@@ -32,18 +32,180 @@ enum class CfaPattern : int {
   CFA_GBRG = 4
 };
 
+enum class DemosaicAlgorithm : int {
+  Malvar = 0,   // 5x5 gradient-corrected filters
+  Bilinear = 1, // averages of the nearest neighbours; for previews
+  Binned = 2    // one pixel per 2x2 quad (see bin_quads); for thumbnails
+};
+
+enum class OutputFormat : int {
+  U8 = 0,       // display-referred: gamma and contrast applied
+  U16 = 1,      // display-referred, at 16 bits
+  U16Linear = 2 // the linear sRGB of the tone mapping, at 16 bits
+};
+
+/*
+ * FinishStages -- Per-job controls of the optional stages of finish, meant to
+ * be pipeline inputs. The enables must be boolean parameters: the stages
+ * that read an optional stage select between it and its bypass and are
+ * specialized on the enable, so a stage disabled at run time is skipped and
+ * no copy is made. An undefined member keeps the fixed behaviour: no chroma
+ * denoising or sharpening, three tone mapping passes, sharpen_strength 2 and
+ * contrast_strength 5.
+ */
+struct FinishStages {
+  Halide::Expr chroma_denoise;      // bool
+  Halide::Expr sharpen;             // bool
+  Halide::Expr sharpen_strength;    // float
+  Halide::Expr multi_pass_tone_map; // bool; one fusion pass when false
+  Halide::Expr contrast_strength;   // float
+};
+
+/*
+ * FinishOptions -- The optional, compile time settings of finish, described
+ * there. The defaults give the full quality 8-bit pipeline.
+ */
+struct FinishOptions {
+  DemosaicAlgorithm demosaic_algorithm = DemosaicAlgorithm::Malvar;
+  int tone_map_downsample = 1;
+  bool fold_color_matrix = false;
+  FinishStages stages;
+  OutputFormat output_format = OutputFormat::U8;
+};
+
+/*
+ * normalize_raw -- Shifts the CFA pattern of a raw image to RG/GB, applies the
+ * black and white levels and white balances it, in a single pass.
+ */
+Halide::Func normalize_raw(Halide::Func input, Halide::Expr width,
+                           Halide::Expr height, Halide::Expr bp,
+                           Halide::Expr wp, const CompiletimeWhiteBalance &wb,
+                           Halide::Expr cfa_pattern);
+
+/*
+ * demosaic -- Interpolates the RGB channels output(x, y, c) of an RG/GB bayer
+ * mosaic, with the Malvar et al. 5x5 filters or bilinearly. If color_matrix is
+ * defined, output(c) = u16_sat(sum_r color_matrix(r, c) * rgb(r)) instead,
+ * computed in the same pass. The Binned algorithm returns bin_quads, at half
+ * the width and height.
+ */
+Halide::Func
+demosaic(Halide::Func input, Halide::Expr width, Halide::Expr height,
+         DemosaicAlgorithm algorithm = DemosaicAlgorithm::Malvar,
+         Halide::Func color_matrix = Halide::Func());
+
+/*
+ * bin_quads -- Bins each RG/GB quad of a bayer mosaic into one RGB pixel:
+ * output(x, y) holds the red, mean green and blue samples of the quad at
+ * (2x, 2y). color_matrix is applied as in demosaic.
+ */
+Halide::Func bin_quads(Halide::Func input,
+                       Halide::Func color_matrix = Halide::Func());
+
+/*
+ * bilateral_filter -- Denoises the UV channels of a YUV image with a 7x7
+ * bilateral filter on each, weighted by the difference in that channel.
+ */
+Halide::Func bilateral_filter(Halide::Func input, Halide::Expr width,
+                              Halide::Expr height);
+
+/*
+ * bilateral_grid -- Denoises the UV channels of a YUV image with a joint
+ * bilateral filter guided by Y, computed on a bilateral grid. Faster than
+ * bilateral_filter but much stronger: it also blurs chroma edges that have no
+ * luma edge.
+ */
+Halide::Func bilateral_grid(Halide::Func input, Halide::Expr width,
+                            Halide::Expr height);
+
+/*
+ * chroma_denoise -- Reduces chromatic noise of a u16 RGB image in YUV, with
+ * num_passes passes of increasing aggressiveness. recursive_blur and
+ * fixed_point_yuv select the recursive blur (see gauss_iir) and the i16 YUV
+ * representation (see rgb_to_yuv); bilateral_on_grid replaces the first pass,
+ * bilateral_filter, with bilateral_grid.
+ */
+Halide::Func chroma_denoise(Halide::Func input, Halide::Expr width,
+                            Halide::Expr height, int num_passes,
+                            bool recursive_blur = false,
+                            bool fixed_point_yuv = false,
+                            bool bilateral_on_grid = false);
+
+/*
+ * sharpen -- Unsharp masks the luma of a u16 RGB image. Its YUV conversion is
+ * specialized on input_enables, the boolean parameters input selects on.
+ */
+Halide::Func sharpen(Halide::Func input, Halide::Expr strength,
+                     bool fixed_point_yuv = false,
+                     const std::vector<Halide::Expr> &input_enables = {});
+
+/*
+ * srgb -- Converts to linear sRGB: output(c) = sum_r srgb_matrix(r, c) * in(r).
+ */
+Halide::Func srgb(Halide::Func input, Halide::Func srgb_matrix);
+
+/*
+ * tone_map -- Compresses the dynamic range of the u16 RGB input by exposure
+ * fusion of brightened copies of its grayscale image. With downsample > 1 the
+ * fusion runs at 1/downsample resolution and is guided-upsampled back. If
+ * multi_pass (a boolean parameter) is defined, it selects at run time between
+ * the three fusion passes and a single one; the consumers of the output
+ * must then be specialized on it. The grayscale image is specialized on
+ * input_enables, the boolean parameters input selects on.
+ */
+Halide::Func tone_map(Halide::Func input, Halide::Expr width,
+                      Halide::Expr height, Halide::Expr comp,
+                      Halide::Expr gain, int downsample = 1,
+                      Halide::Expr multi_pass = Halide::Expr(),
+                      const std::vector<Halide::Expr> &input_enables = {});
+
+/*
+ * contrast -- Boosts the global contrast of an image with an S-shaped
+ * scaled cosine curve followed by black level subtraction and renormalization.
+ */
+Halide::Func contrast(Halide::Func input, Halide::Expr strength,
+                      int black_level);
+
+/*
+ * u8bit_interleaved -- Converts to 8 bits and interleaves color channels.
+ */
+Halide::Func u8bit_interleaved(Halide::Func input);
+
+/*
+ * tone_curve_interleaved -- Applies gamma_correct, contrast and
+ * u8bit_interleaved in one pass through a single precomputed u16 -> u8 table.
+ * The output is identical to that of the three stages. With bits = 16 the
+ * table and the interleaved output stay u16, skipping the 8-bit conversion.
+ */
+Halide::Func tone_curve_interleaved(Halide::Func input, Halide::Expr strength,
+                                    int black_level, int bits = 8);
+
 /*
  * finish -- Applies a series of standard local and global image processing
  * operations to an input mosaicked image, producing a pleasant color output.
  * Input pecifies black-level, white-level and white balance. Additionally,
  * tone mapping is applied to the image, as specified by the input compression
  * and gain amounts. This produces natural-looking brightened shadows, without
- * blowing out highlights. The output values are 8-bit.
+ * blowing out highlights. The output values are 8-bit. Of the options
+ * (FinishOptions), demosaic_algorithm trades demosaic quality for speed, and
+ * Binned also halves the output width and height; tone_map_downsample > 1
+ * computes the tone mapping at reduced resolution. fold_color_matrix applies
+ * the white balance gains and the color matrix as one 3x3 transform in the
+ * demosaic pass instead of before and after it. This moves chroma denoising
+ * after the color matrix, onto linear sRGB instead of white balanced camera
+ * RGB, which changes its result slightly: the denoise filters the chroma of
+ * any linear RGB, and splitting the matrix around it would give back the
+ * pass the fold saves. stages enables chroma denoising, sharpening and
+ * multi-pass tone mapping per job (see FinishStages). output_format selects
+ * 16-bit output instead, display-referred or linear; the linear output skips
+ * gamma correction, contrast and sharpening.
  */
 Halide::Func finish(Halide::Func input, int width, int height, BlackPoint bp,
                     WhitePoint wp, const WhiteBalance &wb, CfaPattern cfa,
-                    Halide::Func ccm, Compression c, Gain g);
+                    Halide::Func ccm, Compression c, Gain g,
+                    const FinishOptions &options = FinishOptions());
 Halide::Func finish(Halide::Func input, Halide::Expr width, Halide::Expr height,
                     Halide::Expr bp, Halide::Expr wp,
                     const CompiletimeWhiteBalance &wb, Halide::Expr cfa_pattern,
-                    Halide::Func ccm, Halide::Expr c, Halide::Expr g);
\ No newline at end of file
+                    Halide::Func ccm, Halide::Expr c, Halide::Expr g,
+                    const FinishOptions &options = FinishOptions());
\ No newline at end of file
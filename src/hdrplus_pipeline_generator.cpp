@@ -22,19 +22,100 @@ public:
   Input<float> compression{"compression"};
   Input<float> gain{"gain"};
 
-  // RGB output
-  Output<Halide::Buffer<uint8_t>> output{"output", 3};
+  // Per-job stage controls (see FinishStages in finish.h); previews disable
+  // the optional stages, final renders enable them
+  Input<bool> chroma_denoise{"chroma_denoise"};
+  Input<bool> sharpen{"sharpen"};
+  Input<float> sharpen_strength{"sharpen_strength"};
+  Input<bool> multi_pass_tone_map{"multi_pass_tone_map"};
+  Input<float> contrast_strength{"contrast_strength"};
+
+  // RGB output. Only the region of the output buffer is rendered: a buffer
+  // covering a region of interest (a nonzero x, y min or a smaller extent)
+  // limits alignment, merge and finish to the tiles and stencil halos it
+  // depends on. Its type is uint8 or uint16, as set by output_format
+  Output<Halide::Buffer<>> output{"output", 3};
+  // Adds the 'telemetry' output described in align.h
+  GeneratorParam<bool> alignment_telemetry{"alignment_telemetry", false};
+  Output<Halide::Buffer<uint32_t>> *telemetry = nullptr;
+  // Uses the fixed-point temporal merge (see merge.h)
+  GeneratorParam<bool> fixed_point_merge{"fixed_point_merge", false};
+  // Uses the frequency-domain temporal merge (see merge.h); takes precedence
+  // over fixed_point_merge
+  GeneratorParam<bool> frequency_merge{"frequency_merge", false};
+  // Uses the sharpest frame of the burst as the reference instead of frame 0
+  GeneratorParam<bool> sharpest_reference{"sharpest_reference", false};
+  // Demosaic algorithm (see finish.h); "bilinear" is the cheap preview mode
+  // and "binned" renders at half the width and height of the input
+  GeneratorParam<DemosaicAlgorithm> demosaic_algorithm{
+      "demosaic_algorithm",
+      DemosaicAlgorithm::Malvar,
+      {{"malvar", DemosaicAlgorithm::Malvar},
+       {"bilinear", DemosaicAlgorithm::Bilinear},
+       {"binned", DemosaicAlgorithm::Binned}}};
+  // Computes the tone mapping at 1/tone_map_downsample resolution (see
+  // finish.h); 1 keeps it at full resolution
+  GeneratorParam<int> tone_map_downsample{"tone_map_downsample", 1, 1, 16};
+  // Applies white balance and the color matrix as one transform fused into
+  // the demosaic, ahead of chroma denoising (see finish.h)
+  GeneratorParam<bool> fold_color_matrix{"fold_color_matrix", false};
+  // Output format (see finish.h): "u16" keeps the display-referred output at
+  // 16 bits and "u16_linear" outputs the linear tone mapped image
+  GeneratorParam<OutputFormat> output_format{
+      "output_format",
+      OutputFormat::U8,
+      {{"u8", OutputFormat::U8},
+       {"u16", OutputFormat::U16},
+       {"u16_linear", OutputFormat::U16Linear}}};
+  // Adds the frame_width and frame_height inputs, which give the frame size
+  // instead of the extent of 'inputs', so that 'inputs' may hold only the rows
+  // a strip of the output depends on (see StripRenderer.h)
+  GeneratorParam<bool> out_of_core{"out_of_core", false};
+  Input<int> *frame_width = nullptr;
+  Input<int> *frame_height = nullptr;
+
+  void configure() {
+    if (alignment_telemetry) {
+      telemetry = add_output<Halide::Buffer<uint32_t>>("telemetry", 2);
+    }
+    if (out_of_core) {
+      frame_width = add_input<int>("frame_width");
+      frame_height = add_input<int>("frame_height");
+    }
+  }
 
   void generate() {
     // Algorithm
-    Func alignment = align(inputs, inputs.width(), inputs.height());
-    Func merged = merge(inputs, inputs.width(), inputs.height(),
-                        inputs.dim(2).extent(), alignment);
+    Expr width = out_of_core ? Expr(*frame_width) : inputs.width();
+    Expr height = out_of_core ? Expr(*frame_height) : inputs.height();
+    Expr frames = inputs.dim(2).extent();
+    Func imgs = inputs;
+    if (sharpest_reference) {
+      imgs = with_sharpest_reference(inputs, width, height, frames);
+    }
+    Func alignment;
+    if (alignment_telemetry) {
+      Func telemetry_func;
+      alignment = align(imgs, width, height, frames, telemetry_func);
+      *telemetry = telemetry_func;
+    } else {
+      alignment = align(imgs, width, height);
+    }
+    Func merged = frequency_merge
+                      ? merge_frequency(imgs, width, height, frames, alignment)
+                      : merge(imgs, width, height, frames, alignment,
+                              fixed_point_merge);
     CompiletimeWhiteBalance wb{white_balance_r, white_balance_g0,
                                white_balance_g1, white_balance_b};
-    Func finished =
-        finish(merged, inputs.width(), inputs.height(), black_point,
-               white_point, wb, cfa_pattern, ccm, compression, gain);
+    FinishOptions options;
+    options.demosaic_algorithm = demosaic_algorithm;
+    options.tone_map_downsample = tone_map_downsample;
+    options.fold_color_matrix = fold_color_matrix;
+    options.stages = {chroma_denoise, sharpen, sharpen_strength,
+                      multi_pass_tone_map, contrast_strength};
+    options.output_format = output_format;
+    Func finished = finish(merged, width, height, black_point, white_point,
+                           wb, cfa_pattern, ccm, compression, gain, options);
     output = finished;
     // Schedule handled inside included functions
   }
@@ -1,9 +1,11 @@
 #include <jni.h>
+#include <iostream>
 #include <vector>
 #include <stdexcept>
 #include <string>
 
 #include "../Burst.h"
+#include "../ReferenceSelection.h"
 #include <align_and_merge.h> // Generated by Halide
 
 static void ThrowRuntimeException(JNIEnv* env, const char* message) {
@@ -14,9 +16,10 @@ static void ThrowRuntimeException(JNIEnv* env, const char* message) {
     }
 }
 
-extern "C" {
-
-JNIEXPORT jbyteArray JNICALL Java_top_maary_darkbag_hdrplus_NativeHDRPlus_process(JNIEnv *env, jclass clazz, jobjectArray buffers) {
+// Merges the burst in buffers into a DNG. With sharpestReference, the
+// sharpest frame rather than the first is used as the reference and as the
+// metadata template.
+static jbyteArray ProcessBurst(JNIEnv *env, jobjectArray buffers, bool sharpestReference) {
     try {
         if (buffers == nullptr) {
             throw std::invalid_argument("Buffers array is null");
@@ -60,6 +63,14 @@ JNIEXPORT jbyteArray JNICALL Java_top_maary_darkbag_hdrplus_NativeHDRPlus_proces
              throw std::runtime_error("Failed to create input buffer from Burst");
         }
 
+        int reference = 0;
+        if (sharpestReference) {
+            double scoringMs = 0;
+            reference = SelectSharpestReference(input, scoringMs);
+            std::cerr << "reference frame: " << reference << " (scored in "
+                      << scoringMs << " ms)" << std::endl;
+        }
+
         // Prepare Output buffer
         // Expected layout: (width, height)
         // align_and_merge produces a single merged RAW image
@@ -72,9 +83,9 @@ JNIEXPORT jbyteArray JNICALL Java_top_maary_darkbag_hdrplus_NativeHDRPlus_proces
         }
 
         // Encode output to DNG in memory
-        // We use the first frame as a template for metadata
+        // We use the reference frame as a template for metadata
         std::vector<uint8_t> dngData;
-        burst.GetRaw(0).WriteDng(dngData, output);
+        burst.GetRaw(reference).WriteDng(dngData, output);
 
         // Convert std::vector<uint8_t> to jbyteArray
         jbyteArray jResult = env->NewByteArray(dngData.size());
@@ -95,4 +106,14 @@ JNIEXPORT jbyteArray JNICALL Java_top_maary_darkbag_hdrplus_NativeHDRPlus_proces
     }
 }
 
+extern "C" {
+
+JNIEXPORT jbyteArray JNICALL Java_top_maary_darkbag_hdrplus_NativeHDRPlus_process(JNIEnv *env, jclass clazz, jobjectArray buffers) {
+    return ProcessBurst(env, buffers, false);
+}
+
+JNIEXPORT jbyteArray JNICALL Java_top_maary_darkbag_hdrplus_NativeHDRPlus_processWithSharpestReference(JNIEnv *env, jclass clazz, jobjectArray buffers) {
+    return ProcessBurst(env, buffers, true);
+}
+
 }
@@ -8,6 +8,129 @@
 using namespace Halide;
 using namespace Halide::ConciseCasts;
 
+/*
+ * merge_weight -- weight of an alternate tile in the temporal merge, inversely
+ * proportional to the average L1 distance between the downsampled reference
+ * and alternate tiles, given the sum of L1 distances over the 16x16 tile.
+ * Thresholds L1 scores so that tiles above a certain distance are completely
+ * discounted, and tiles below a certain distance are assumed to be perfectly
+ * aligned.
+ */
+Expr merge_weight(Expr dist_sum) {
+
+  // constants for determining strength and robustness of temporal merge
+
+  float factor = 8.f; // factor by which inverse function is elongated
+  int min_dist = 10;  // pixel L1 distance below which weight is maximal
+  int max_dist = 300; // pixel L1 distance above which weight is zero
+
+  // average L1 distance in tile and distance normalized to min and factor
+
+  Expr dist = dist_sum / 256;
+
+  Expr norm_dist = max(1, i32(dist) / factor - min_dist / factor);
+
+  return select(norm_dist > (max_dist - min_dist), 0.f, 1.f / norm_dist);
+}
+
+/*
+ * merge_weight_fixed -- merge_weight as an unsigned 1.15 fixed-point number,
+ * rounded down: 32768 for tiles assumed perfectly aligned, 0 for discounted
+ * tiles.
+ */
+Expr merge_weight_fixed(Expr dist_sum) {
+
+  // same constants as merge_weight; 1 / norm_dist = factor / (dist - min_dist)
+
+  int factor = 8;
+  int min_dist = 10;
+  int max_dist = 300;
+
+  Expr dist = i32(dist_sum / 256);
+
+  Expr denom = u32(max(factor, dist - min_dist));
+
+  return select(dist - min_dist > factor * (max_dist - min_dist), u16(0),
+                u16(u32(factor << 15) / denom));
+}
+
+/*
+ * contributing_frames -- Compacts, for each tile, the alternate frames
+ * 1 ... frames - 1 whose weight(tx, ty, n) is nonzero: count(tx, ty) of them,
+ * listed in increasing order as frame(tx, ty, k) for k < count(tx, ty). Lets
+ * the per-pixel merge skip the loads of rejected frames entirely.
+ */
+void contributing_frames(Func weight, Expr frames, Func &count, Func &frame) {
+
+  Func rank("contributing_frames_rank");
+
+  Var tx, ty, n, k;
+  RDom r1(1, frames - 1); // reduction over alternate images
+  RDom r2(2, frames - 2); // scan over alternate images after the first
+
+  auto contributes = [&](Expr m) {
+    return select(weight(tx, ty, m) != 0, 1, 0);
+  };
+
+  // rank(tx, ty, n): number of contributing frames among 1 ... n - 1
+
+  rank(tx, ty, n) = 0;
+  rank(tx, ty, r2) = rank(tx, ty, r2 - 1) + contributes(r2 - 1);
+
+  count(tx, ty) = sum(contributes(r1));
+
+  // scatter each contributing frame to its rank
+
+  RDom rc(1, frames - 1);
+  rc.where(weight(tx, ty, rc) != 0);
+
+  frame(tx, ty, k) = 0;
+  frame(tx, ty, clamp(rank(tx, ty, rc), 0, frames - 2)) = rc;
+
+  ///////////////////////////////////////////////////////////////////////////
+  // schedule
+  ///////////////////////////////////////////////////////////////////////////
+
+  rank.compute_root().parallel(ty).vectorize(tx, 16);
+  rank.update().parallel(ty).vectorize(tx, 16);
+
+  count.compute_root().parallel(ty).vectorize(tx, 16);
+
+  frame.compute_root().parallel(ty);
+  frame.update().parallel(ty);
+}
+
+/*
+ * schedule_frame_reduction -- Schedules the per-pixel reduction over frames
+ * alt_sum(ix, iy, tx, ty) += ... over rk, computed per tile of output. For
+ * bursts of at least long_burst frames the reduction is split into groups of
+ * frame_group frames that are summed in parallel (rfactor) and then combined,
+ * so long bursts also scale with core count within a tile.
+ */
+void schedule_frame_reduction(Func alt_sum, RVar rk, Expr frames, Func output,
+                              Var ix, Var iy, Var tx) {
+
+  int long_burst = 32; // frames from which the reduction is split
+  int frame_group = 8; // frames per partial sum
+
+  alt_sum.compute_at(output, tx).vectorize(ix, 32);
+  alt_sum.update().reorder(ix, iy, rk).vectorize(ix, 32);
+
+  RVar rk_outer, rk_inner;
+  Var group;
+
+  Func partial = alt_sum.update()
+                     .specialize(frames >= long_burst)
+                     .split(rk, rk_outer, rk_inner, frame_group)
+                     .rfactor(rk_outer, group);
+
+  partial.compute_at(output, tx).vectorize(ix, 32);
+  partial.update()
+      .reorder(ix, iy, rk_inner, group)
+      .parallel(group)
+      .vectorize(ix, 32);
+}
+
 /*
  * merge_temporal -- combines aligned tiles in the temporal dimension by
  * weighting various frames based on their L1 distance to the reference frame's
@@ -52,44 +175,48 @@ Func merge_temporal(Halide::Func imgs, Expr width, Expr height, Expr frames,
   ref_val = layer(idx_layer(tx, r0.x), idx_layer(ty, r0.y), 0);
   alt_val = layer(al_x, al_y, n);
 
-  // constants for determining strength and robustness of temporal merge
-
-  float factor = 8.f; // factor by which inverse function is elongated
-  int min_dist = 10;  // pixel L1 distance below which weight is maximal
-  int max_dist = 300; // pixel L1 distance above which weight is zero
-
-  // average L1 distance in tile and distance normalized to min and factor
-
-  Expr dist = sum(abs(i32(ref_val) - i32(alt_val))) / 256;
-
-  Expr norm_dist = max(1, i32(dist) / factor - min_dist / factor);
-
   // weight for each tile in temporal merge; inversely proportional to reference
   // and alternate tile L1 distance
 
-  weight(tx, ty, n) =
-      select(norm_dist > (max_dist - min_dist), 0.f, 1.f / norm_dist);
+  weight(tx, ty, n) = merge_weight(sum(abs(i32(ref_val) - i32(alt_val))));
 
   // total weight for each tile in a temporal stack of images
 
   total_weight(tx, ty) = sum(weight(tx, ty, r1)) +
                          1.f; // additional 1.f accounting for reference image
 
+  // alternate frames with a nonzero weight in each tile; rejected frames
+  // would only add zeros
+
+  Func count("merge_temporal_count");
+  Func frame("merge_temporal_frames");
+  contributing_frames(weight, frames, count, frame);
+
+  RDom rk(0, frames - 1); // reduction over contributing alternate images
+  rk.where(rk < count(tx, ty));
+
+  Expr alt_n = clamp(frame(tx, ty, rk), 1, frames - 1);
+
   // expressions for summing over images at each pixel
 
-  offset = P(alignment(tx, ty, r1));
+  offset = P(alignment(tx, ty, alt_n));
 
   al_x = idx_im(tx, ix) + offset.x;
   al_y = idx_im(ty, iy) + offset.y;
 
   ref_val = imgs_mirror(idx_im(tx, ix), idx_im(ty, iy), 0);
-  alt_val = imgs_mirror(al_x, al_y, r1);
+  alt_val = imgs_mirror(al_x, al_y, alt_n);
+
+  // temporal merge function using weighted pixel values; the loop over the
+  // contributing frames runs outside the pixel loops of the tile
 
-  // temporal merge function using weighted pixel values
+  Func alt_sum("merge_temporal_alt_sum");
+  alt_sum(ix, iy, tx, ty) = 0.f;
+  alt_sum(ix, iy, tx, ty) +=
+      weight(tx, ty, alt_n) * alt_val / total_weight(tx, ty);
 
   output(ix, iy, tx, ty) =
-      sum(weight(tx, ty, r1) * alt_val / total_weight(tx, ty)) +
-      ref_val / total_weight(tx, ty);
+      alt_sum(ix, iy, tx, ty) + ref_val / total_weight(tx, ty);
 
   ///////////////////////////////////////////////////////////////////////////
   // schedule
@@ -99,6 +226,352 @@ Func merge_temporal(Halide::Func imgs, Expr width, Expr height, Expr frames,
 
   total_weight.compute_root().parallel(ty).vectorize(tx, 16);
 
+  schedule_frame_reduction(alt_sum, rk, frames, output, ix, iy, tx);
+
+  output.compute_root().parallel(ty).vectorize(ix, 32);
+
+  return output;
+}
+
+/*
+ * merge_temporal_fixed -- merge_temporal in fixed point. Tile weights are
+ * quantized to 1.15 and normalized with a single reciprocal per tile, and the
+ * reference absorbs the rounding so that the weights of each tile sum to
+ * exactly 32768. An alternate's normalized weight is at most 16384, so it is
+ * doubled to 0.16 and each frame of each pixel is the high half of a
+ * u16 x u16 multiply, accumulated in u16: twice the lanes per vector of a u32
+ * accumulator, with no float arithmetic or division. Since the weights sum to
+ * 1, the truncated products cannot overflow; the truncation of each product
+ * is compensated on average by adding half the number of terms at the end.
+ * The output differs from merge_temporal by at most
+ * frames / 2 + 2 * (frames - 1) * spread / 32768, where spread is the largest
+ * difference between an alternate and a reference pixel of the tile.
+ */
+Func merge_temporal_fixed(Halide::Func imgs, Expr width, Expr height,
+                          Expr frames, Func alignment) {
+
+  Func weight("merge_temporal_fixed_weights");
+  Func reciprocal("merge_temporal_fixed_reciprocal");
+  Func norm_weight("merge_temporal_fixed_norm_weights");
+  Func ref_weight("merge_temporal_fixed_ref_weights");
+  Func output("merge_temporal_fixed_output");
+
+  Var ix, iy, tx, ty, n;
+  RDom r0(0, 16, 0, 16);  // reduction over pixels in downsampled tile
+  RDom r1(1, frames - 1); // reduction over alternate images
+
+  // mirror input with overlapping edges
+
+  Func imgs_mirror = BoundaryConditions::mirror_interior(
+      imgs, {Range(0, width), Range(0, height)});
+
+  // downsampled layer for computing L1 distances
+
+  Func layer = box_down2(imgs_mirror, "merge_fixed_layer");
+
+  Point offset;
+  Expr al_x, al_y, ref_val, alt_val;
+
+  // expressions for summing over pixels in each tile
+
+  offset = clamp(P(alignment(tx, ty, n)), P(MIN_OFFSET, MIN_OFFSET),
+                 P(MAX_OFFSET, MAX_OFFSET));
+
+  al_x = idx_layer(tx, r0.x) + offset.x / 2;
+  al_y = idx_layer(ty, r0.y) + offset.y / 2;
+
+  ref_val = layer(idx_layer(tx, r0.x), idx_layer(ty, r0.y), 0);
+  alt_val = layer(al_x, al_y, n);
+
+  // quantized weight for each tile, at most 32768
+
+  weight(tx, ty, n) =
+      merge_weight_fixed(sum(abs(i32(ref_val) - i32(alt_val))));
+
+  // reciprocal of the total weight (including 32768 for the reference image),
+  // scaled by 2^31 so that the normalized weights below are 1.15 and the
+  // product fits in 32 bits
+
+  reciprocal(tx, ty) =
+      u32(uint32_t(1) << 31) / (sum(u32(weight(tx, ty, r1))) + u32(1 << 15));
+
+  norm_weight(tx, ty, n) =
+      u16((u32(weight(tx, ty, n)) * reciprocal(tx, ty) + (1 << 15)) >> 16);
+
+  ref_weight(tx, ty) =
+      u16(i32(1 << 15) - i32(sum(u32(norm_weight(tx, ty, r1)))));
+
+  // alternate frames with a nonzero weight in each tile
+
+  Func count("merge_temporal_fixed_count");
+  Func frame("merge_temporal_fixed_frames");
+  contributing_frames(norm_weight, frames, count, frame);
+
+  RDom rk(0, frames - 1); // reduction over contributing alternate images
+  rk.where(rk < count(tx, ty));
+
+  Expr alt_n = clamp(frame(tx, ty, rk), 1, frames - 1);
+
+  // expressions for summing over images at each pixel
+
+  offset = P(alignment(tx, ty, alt_n));
+
+  al_x = idx_im(tx, ix) + offset.x;
+  al_y = idx_im(ty, iy) + offset.y;
+
+  ref_val = imgs_mirror(idx_im(tx, ix), idx_im(ty, iy), 0);
+  alt_val = imgs_mirror(al_x, al_y, alt_n);
+
+  // temporal merge function using weighted pixel values: the high half of
+  // the product of the 0.16 weight and the pixel, which the weights summing
+  // to 1 keep from overflowing u16 for any number of frames
+
+  Func alt_sum("merge_temporal_fixed_alt_sum");
+  alt_sum(ix, iy, tx, ty) = u16(0);
+  alt_sum(ix, iy, tx, ty) +=
+      u16((u32(2 * norm_weight(tx, ty, alt_n)) * u32(alt_val)) >> 16);
+
+  // the reference weight may be 32768, so its product is taken once per pixel
+  // in 32 bits; half a unit per truncated term restores rounding on average
+
+  Expr ref_term = (u32(ref_weight(tx, ty)) * u32(ref_val)) >> 15;
+  Expr rounding = u32(count(tx, ty) + 1) / 2;
+
+  output(ix, iy, tx, ty) =
+      u16(min(u32(alt_sum(ix, iy, tx, ty)) + ref_term + rounding, 65535));
+
+  ///////////////////////////////////////////////////////////////////////////
+  // schedule
+  ///////////////////////////////////////////////////////////////////////////
+
+  weight.compute_root().parallel(ty).vectorize(tx, 16);
+
+  reciprocal.compute_root().parallel(ty).vectorize(tx, 16);
+
+  norm_weight.compute_root().parallel(ty).vectorize(tx, 16);
+
+  ref_weight.compute_root().parallel(ty).vectorize(tx, 16);
+
+  schedule_frame_reduction(alt_sum, rk, frames, output, ix, iy, tx);
+
+  output.compute_root().parallel(ty).vectorize(ix, 32);
+
+  return output;
+}
+
+/*
+ * twiddle16 -- Tuple(re, im) of the 16-point DFT twiddle factors
+ * exp(-2 * pi * i * k / 16) for k in [0, 16).
+ */
+Func twiddle16() {
+
+  Func twiddle("twiddle16");
+
+  Var k;
+
+  float pi = 3.141592f;
+  Expr angle = 2 * pi * k / 16;
+  twiddle(k) = Tuple(cos(angle), -sin(angle));
+
+  twiddle.compute_root();
+
+  return twiddle;
+}
+
+/*
+ * fft16 -- 16-point radix-2 decimation-in-time FFT of the complex input(u,
+ * rest...), a Tuple(re, im), along its first dimension. The inverse transform
+ * is unnormalized. Each butterfly stage is computed at the given loop level and
+ * vectorized over the first of the remaining dimensions.
+ */
+Func fft16(Func input, Var u, std::vector<Var> rest, Func twiddle, bool inverse,
+           Func consumer, Var consumer_var, std::string name) {
+
+  auto args = [&](Expr first) {
+    std::vector<Expr> result = {first};
+    result.insert(result.end(), rest.begin(), rest.end());
+    return result;
+  };
+
+  std::vector<Var> pure = {u};
+  pure.insert(pure.end(), rest.begin(), rest.end());
+
+  // inputs in bit-reversed order
+
+  Expr bitrev = ((u & 1) << 3) | ((u & 2) << 1) | ((u & 4) >> 1) |
+                ((u & 8) >> 3);
+
+  Func stage(name + "_bitrev");
+  stage(pure) = input(args(bitrev));
+
+  std::vector<Func> stages = {stage};
+
+  // butterflies combining blocks of size h into blocks of size 2 * h
+
+  for (int h = 1; h < 16; h *= 2) {
+
+    Func next(name + "_stage_" + std::to_string(h));
+
+    Expr p = (u / (2 * h)) * (2 * h) + u % h; // even element of the pair
+    Expr q = p + h;                           // odd element of the pair
+    Expr sign = select(u % (2 * h) < h, 1.f, -1.f);
+
+    Tuple w = twiddle((u % h) * (8 / h));
+    Expr w_re = w[0];
+    Expr w_im = inverse ? -w[1] : w[1];
+
+    Tuple a = stage(args(p));
+    Tuple b = stage(args(q));
+
+    Expr b_re = b[0] * w_re - b[1] * w_im;
+    Expr b_im = b[0] * w_im + b[1] * w_re;
+
+    next(pure) = Tuple(a[0] + sign * b_re, a[1] + sign * b_im);
+
+    stage = next;
+    stages.push_back(stage);
+  }
+
+  ///////////////////////////////////////////////////////////////////////////
+  // schedule
+  ///////////////////////////////////////////////////////////////////////////
+
+  for (Func f : stages) {
+    f.compute_at(consumer, consumer_var).vectorize(rest[0], 8);
+  }
+
+  return stage;
+}
+
+/*
+ * merge_temporal_frequency -- combines aligned tiles in the temporal dimension
+ * per spatial frequency, following the Wiener-style merge of the HDR+ paper.
+ * Each color channel of a tile is a 16x16 plane; for every frame the plane's
+ * DFT is pulled toward the reference's DFT by
+ *
+ *   A = |D|^2 / (|D|^2 + c * sigma^2)
+ *
+ * where D is the difference of the two spectra and sigma^2 the noise variance
+ * of the difference. Frequencies that differ by little more than noise are
+ * averaged, those that differ by much more (motion, misalignment) fall back to
+ * the reference. The noise variance is estimated per tile and channel from the
+ * highest-frequency bins of the reference spectrum, where noise dominates the
+ * scene content. Tiles are independent and computed in parallel.
+ */
+Func merge_temporal_frequency(Halide::Func imgs, Expr width, Expr height,
+                              Expr frames, Func alignment) {
+
+  Func plane("merge_frequency_planes");
+  Func noise("merge_frequency_noise");
+  Func shrink("merge_frequency_shrink");
+  Func merged("merge_frequency_merged");
+  Func planes_output("merge_frequency_planes_output");
+  Func output("merge_frequency_output");
+
+  Var u, v, c, tx, ty, n, ix, iy;
+  RDom r1(1, frames - 1); // reduction over alternate images
+  RDom rh(6, 5, 6, 5);    // highest-frequency bins, for the noise estimate
+
+  // tuning constant of the shrinkage; larger merges more aggressively
+
+  float wiener_c = 8.f;
+
+  // mirror input with overlapping edges
+
+  Func imgs_mirror = BoundaryConditions::mirror_interior(
+      imgs, {Range(0, width), Range(0, height)});
+
+  // color planes of each aligned tile; offsets are even, so the bayer phase
+  // of the tile is that of the reference
+
+  Point offset = P(alignment(tx, ty, n));
+  offset = select(n == 0, P(0, 0), offset);
+
+  Expr x = idx_im(tx, 2 * u + c % 2) + offset.x;
+  Expr y = idx_im(ty, 2 * v + c / 2) + offset.y;
+
+  plane(u, v, c, tx, ty, n) = Tuple(f32(imgs_mirror(x, y, n)), 0.f);
+
+  // 2D DFT: rows, then columns of the transposed rows
+
+  Func twiddle = twiddle16();
+
+  Func rows = fft16(plane, u, {v, c, tx, ty, n}, twiddle, false, planes_output,
+                    tx, "merge_frequency_fft_rows");
+
+  Func rows_t("merge_frequency_rows_t");
+  rows_t(v, u, c, tx, ty, n) = rows(u, v, c, tx, ty, n);
+
+  Func cols = fft16(rows_t, v, {u, c, tx, ty, n}, twiddle, false,
+                    planes_output, tx, "merge_frequency_fft_cols");
+
+  auto spectrum = [&](Expr fu, Expr fv, Expr fn) {
+    return cols(fv, fu, c, tx, ty, fn);
+  };
+
+  // noise variance of the difference of two frames at one frequency: twice
+  // the variance of a single frame, which for the unnormalized DFT is the
+  // mean power of the highest frequencies
+
+  Tuple ref_high = spectrum(rh.x, rh.y, 0);
+
+  noise(c, tx, ty) =
+      2.f * sum(ref_high[0] * ref_high[0] + ref_high[1] * ref_high[1]) / 25.f;
+
+  // per-frequency shrinkage toward the reference
+
+  Tuple ref = spectrum(u, v, 0);
+  Tuple alt = spectrum(u, v, n);
+
+  Expr d_re = ref[0] - alt[0];
+  Expr d_im = ref[1] - alt[1];
+  Expr d_power = d_re * d_re + d_im * d_im;
+
+  shrink(u, v, c, tx, ty, n) =
+      d_power / (d_power + wiener_c * noise(c, tx, ty) + 1e-6f);
+
+  // merged spectrum: average of the shrunk alternates and the reference
+
+  Tuple ref_m = spectrum(u, v, 0);
+  Tuple alt_m = spectrum(u, v, r1);
+  Expr a = shrink(u, v, c, tx, ty, r1);
+
+  merged(u, v, c, tx, ty) =
+      Tuple((ref_m[0] + sum(alt_m[0] + a * (ref_m[0] - alt_m[0]))) / frames,
+            (ref_m[1] + sum(alt_m[1] + a * (ref_m[1] - alt_m[1]))) / frames);
+
+  // inverse 2D DFT back to the color planes
+
+  Func inv_rows = fft16(merged, u, {v, c, tx, ty}, twiddle, true,
+                        planes_output, tx, "merge_frequency_ifft_rows");
+
+  Func inv_rows_t("merge_frequency_inv_rows_t");
+  inv_rows_t(v, u, c, tx, ty) = inv_rows(u, v, c, tx, ty);
+
+  Func inv_cols = fft16(inv_rows_t, v, {u, c, tx, ty}, twiddle, true,
+                        planes_output, tx, "merge_frequency_ifft_cols");
+
+  planes_output(u, v, c, tx, ty) = inv_cols(v, u, c, tx, ty)[0] / 256.f;
+
+  // back to bayer tiles as produced by merge_temporal
+
+  output(ix, iy, tx, ty) =
+      planes_output(ix / 2, iy / 2, ix % 2 + 2 * (iy % 2), tx, ty);
+
+  ///////////////////////////////////////////////////////////////////////////
+  // schedule
+  ///////////////////////////////////////////////////////////////////////////
+
+  plane.compute_at(planes_output, tx).vectorize(u, 8);
+
+  noise.compute_at(planes_output, tx);
+
+  shrink.compute_at(planes_output, tx).vectorize(u, 8);
+
+  merged.compute_at(planes_output, tx).vectorize(u, 8);
+
+  planes_output.compute_root().parallel(ty).vectorize(u, 8);
+
   output.compute_root().parallel(ty).vectorize(ix, 32);
 
   return output;
@@ -106,62 +579,187 @@ Func merge_temporal(Halide::Func imgs, Expr width, Expr height, Expr frames,
 
 /*
  * merge_spatial -- smoothly blends between half-overlapped tiles in the spatial
- * domain using a raised cosine filter.
+ * domain using a raised cosine filter. The window is fixed at T_SIZE, so the
+ * four tile weights of a pixel only depend on its position modulo T_SIZE_2;
+ * they are precomputed once as 0.16 fixed-point products that sum to exactly
+ * 65536, and the blend is a u16 x u16 -> u32 multiply-accumulate written
+ * directly as u16. Float tiles are rounded to u16 first. The result is within
+ * 1 LSB of blending in float.
  */
 Func merge_spatial(Func input) {
 
   Func weight("raised_cosine_weights");
+  Func table("raised_cosine_table");
   Func output("merge_spatial_output");
 
-  Var v, x, y;
+  Var v, x, y, xm, ym;
 
   // (modified) raised cosine window for determining pixel weights
 
   float pi = 3.141592f;
   weight(v) = 0.5f - 0.5f * cos(2 * pi * (v + 0.5f) / T_SIZE);
 
-  // tile weights based on pixel position
+  // weights of the four overlapping tiles by pixel position within a tile
+  // stride; the left/upper tile takes the rounding so that they sum to 65536
 
-  Expr weight_00 = weight(idx_0(x)) * weight(idx_0(y));
-  Expr weight_10 = weight(idx_1(x)) * weight(idx_0(y));
-  Expr weight_01 = weight(idx_0(x)) * weight(idx_1(y));
-  Expr weight_11 = weight(idx_1(x)) * weight(idx_1(y));
+  Expr weight_10 = u16(round(weight(xm) * weight(ym + T_SIZE_2) * 65536.f));
+  Expr weight_01 = u16(round(weight(xm + T_SIZE_2) * weight(ym) * 65536.f));
+  Expr weight_11 = u16(round(weight(xm) * weight(ym) * 65536.f));
+  Expr weight_00 = u16(65536 - i32(weight_10) - i32(weight_01) -
+                       i32(weight_11));
 
-  // values of pixels from each overlapping tile
+  table(xm, ym) = Tuple(weight_00, weight_10, weight_01, weight_11);
 
-  Expr val_00 = input(idx_0(x), idx_0(y), tile_0(x), tile_0(y));
-  Expr val_10 = input(idx_1(x), idx_0(y), tile_1(x), tile_0(y));
-  Expr val_01 = input(idx_0(x), idx_1(y), tile_0(x), tile_1(y));
-  Expr val_11 = input(idx_1(x), idx_1(y), tile_1(x), tile_1(y));
+  // values of pixels from each overlapping tile, as u16
+
+  auto value = [&](Expr ix, Expr iy, Expr tx, Expr ty) {
+    Expr val = input(ix, iy, tx, ty);
+    if (val.type().is_float()) {
+      val = clamp(round(val), 0.f, 65535.f);
+    }
+    return u32(u16(val));
+  };
+
+  Expr val_00 = value(idx_0(x), idx_0(y), tile_0(x), tile_0(y));
+  Expr val_10 = value(idx_1(x), idx_0(y), tile_1(x), tile_0(y));
+  Expr val_01 = value(idx_0(x), idx_1(y), tile_0(x), tile_1(y));
+  Expr val_11 = value(idx_1(x), idx_1(y), tile_1(x), tile_1(y));
 
   // spatial merge function using weighted pixel values
 
-  output(x, y) = u16(weight_00 * val_00 + weight_10 * val_10 +
-                     weight_01 * val_01 + weight_11 * val_11);
+  Tuple w = table(x % T_SIZE_2, y % T_SIZE_2);
+
+  output(x, y) = u16((u32(w[0]) * val_00 + u32(w[1]) * val_10 +
+                      u32(w[2]) * val_01 + u32(w[3]) * val_11) >>
+                     16);
 
   ///////////////////////////////////////////////////////////////////////////
   // schedule
   ///////////////////////////////////////////////////////////////////////////
 
-  weight.compute_root().vectorize(v, 32);
+  weight.compute_root();
+
+  table.compute_root();
 
   output.compute_root().parallel(y).vectorize(x, 32);
 
   return output;
 }
 
+/*
+ * merge_accumulate -- adds one aligned alternate frame to the running sums of
+ * a streaming temporal merge. sum_in(ix, iy, tx, ty) accumulates weighted
+ * pixel values of each tile and weight_in(tx, ty) the tile weights, so that
+ * the temporal merge of merge_temporal is (sum + reference) / (weight + 1).
+ */
+MergeAccumulators merge_accumulate(Func ref_layer, Func alternate,
+                                   Func alt_layer, Expr width, Expr height,
+                                   Func alignment, Func sum_in,
+                                   Func weight_in) {
+
+  Func tile_weight("merge_accumulate_tile_weights");
+  Func sum_output("merge_accumulate_sum");
+  Func weight_output("merge_accumulate_weight");
+
+  Var ix, iy, tx, ty;
+  RDom r0(0, 16, 0, 16); // reduction over pixels in downsampled tile
+
+  // mirror input with overlapping edges
+
+  Func alt_mirror = BoundaryConditions::mirror_interior(
+      alternate, {Range(0, width), Range(0, height)});
+
+  // weight of the alternate tile, as in merge_temporal
+
+  Point offset = clamp(P(alignment(tx, ty)), P(MIN_OFFSET, MIN_OFFSET),
+                       P(MAX_OFFSET, MAX_OFFSET));
+
+  Expr ref_val = ref_layer(idx_layer(tx, r0.x), idx_layer(ty, r0.y));
+  Expr alt_val = alt_layer(idx_layer(tx, r0.x) + offset.x / 2,
+                           idx_layer(ty, r0.y) + offset.y / 2);
+
+  tile_weight(tx, ty) = merge_weight(sum(abs(i32(ref_val) - i32(alt_val))));
+
+  // accumulate weighted pixel values and weights
+
+  offset = P(alignment(tx, ty));
+
+  alt_val = alt_mirror(idx_im(tx, ix) + offset.x, idx_im(ty, iy) + offset.y);
+
+  sum_output(ix, iy, tx, ty) =
+      sum_in(ix, iy, tx, ty) + tile_weight(tx, ty) * alt_val;
+
+  weight_output(tx, ty) = weight_in(tx, ty) + tile_weight(tx, ty);
+
+  ///////////////////////////////////////////////////////////////////////////
+  // schedule
+  ///////////////////////////////////////////////////////////////////////////
+
+  tile_weight.compute_root().parallel(ty).vectorize(tx, 16);
+
+  sum_output.compute_root().parallel(ty).vectorize(ix, 32);
+
+  weight_output.compute_root().parallel(ty).vectorize(tx, 16);
+
+  return {sum_output, weight_output};
+}
+
+/*
+ * merge_finish -- completes a streaming merge: normalizes the accumulated
+ * temporal sums by the accumulated weights, including the reference frame,
+ * and blends the tiles spatially.
+ */
+Func merge_finish(Func reference, Expr width, Expr height, Func sum,
+                  Func weight) {
+
+  Func output("merge_finish_temporal_output");
+
+  Var ix, iy, tx, ty;
+
+  Func ref_mirror = BoundaryConditions::mirror_interior(
+      reference, {Range(0, width), Range(0, height)});
+
+  Expr ref_val = ref_mirror(idx_im(tx, ix), idx_im(ty, iy));
+
+  output(ix, iy, tx, ty) =
+      (sum(ix, iy, tx, ty) + ref_val) / (weight(tx, ty) + 1.f);
+
+  ///////////////////////////////////////////////////////////////////////////
+  // schedule
+  ///////////////////////////////////////////////////////////////////////////
+
+  output.compute_root().parallel(ty).vectorize(ix, 32);
+
+  return merge_spatial(output);
+}
+
 /*
  * merge -- fully merges aligned frames in the temporal and spatial
  * dimension to produce one denoised bayer frame.
  */
 Func merge(Halide::Func imgs, Halide::Expr width, Halide::Expr height,
-           Halide::Expr frames, Halide::Func alignment) {
+           Halide::Expr frames, Halide::Func alignment, bool fixed_point) {
+  Func merge_temporal_output =
+      fixed_point
+          ? merge_temporal_fixed(imgs, width, height, frames, alignment)
+          : merge_temporal(imgs, width, height, frames, alignment);
+  return merge_spatial(merge_temporal_output);
+}
+
+/*
+ * merge_frequency -- fully merges aligned frames like merge(), with the
+ * temporal merge done per spatial frequency.
+ */
+Func merge_frequency(Halide::Func imgs, Halide::Expr width,
+                     Halide::Expr height, Halide::Expr frames,
+                     Halide::Func alignment) {
   Func merge_temporal_output =
-      merge_temporal(imgs, width, height, frames, alignment);
+      merge_temporal_frequency(imgs, width, height, frames, alignment);
   return merge_spatial(merge_temporal_output);
 }
 
-Halide::Func merge(Halide::Buffer<uint16_t> imgs, Halide::Func alignment) {
+Halide::Func merge(Halide::Buffer<uint16_t> imgs, Halide::Func alignment,
+                   bool fixed_point) {
   return merge(Halide::Func(imgs), imgs.width(), imgs.height(), imgs.extent(2),
-               alignment);
+               alignment, fixed_point);
 }
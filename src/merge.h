@@ -4,8 +4,63 @@
 
 /*
  * merge -- fully merges aligned frames in the temporal and spatial
- * dimension to produce one denoised bayer frame.
+ * dimension to produce one denoised bayer frame. With fixed_point, the
+ * temporal merge uses quantized tile weights and integer arithmetic (see
+ * merge_temporal_fixed in merge.cpp); the result is within a few LSB of the
+ * float merge.
  */
 Halide::Func merge(Halide::Func imgs, Halide::Expr width, Halide::Expr height,
-                   Halide::Expr frames, Halide::Func alignment);
-Halide::Func merge(Halide::Buffer<uint16_t> imgs, Halide::Func alignment);
+                   Halide::Expr frames, Halide::Func alignment,
+                   bool fixed_point = false);
+Halide::Func merge(Halide::Buffer<uint16_t> imgs, Halide::Func alignment,
+                   bool fixed_point = false);
+
+/*
+ * merge_frequency -- As merge(), but the temporal merge is a per-tile,
+ * per-frequency Wiener-style merge on 16x16 DFTs of each color channel of the
+ * tiles, as in the HDR+ paper. It rejects motion per frequency instead of per
+ * tile at the cost of a forward FFT per frame and tile.
+ */
+Halide::Func merge_frequency(Halide::Func imgs, Halide::Expr width,
+                             Halide::Expr height, Halide::Expr frames,
+                             Halide::Func alignment);
+
+/*
+ * merge_spatial -- blends the half-overlapping tiles input(ix, iy, tx, ty) of
+ * a temporal merge into an image with a raised cosine window. Tiles may be
+ * u16 or float.
+ */
+Halide::Func merge_spatial(Halide::Func input);
+
+/*
+ * MergeAccumulators -- running per-tile sums of a streaming temporal merge:
+ * sum(ix, iy, tx, ty) of weighted alternate pixel values and weight(tx, ty)
+ * of alternate tile weights. Tiles range over [-1, width / T_SIZE_2 - 1] and
+ * [-1, height / T_SIZE_2 - 1], the tiles read by the spatial merge.
+ */
+struct MergeAccumulators {
+  Halide::Func sum;
+  Halide::Func weight;
+};
+
+/*
+ * merge_accumulate -- adds one alternate frame, aligned by alignment(tx, ty),
+ * to the accumulators of a streaming merge. ref_layer(x, y) and alt_layer(x,
+ * y) are the finest alignment pyramid layers of the reference and alternate
+ * frames. Peak memory is independent of the number of frames in the burst.
+ */
+MergeAccumulators merge_accumulate(Halide::Func ref_layer,
+                                   Halide::Func alternate,
+                                   Halide::Func alt_layer, Halide::Expr width,
+                                   Halide::Expr height, Halide::Func alignment,
+                                   Halide::Func sum_in,
+                                   Halide::Func weight_in);
+
+/*
+ * merge_finish -- produces the merged bayer frame from the reference and the
+ * accumulators of a streaming merge. Matches merge() on the same frames to
+ * within float rounding of the temporal sums (at most 1 LSB).
+ */
+Halide::Func merge_finish(Halide::Func reference, Halide::Expr width,
+                          Halide::Expr height, Halide::Func sum,
+                          Halide::Func weight);
@@ -0,0 +1,43 @@
+#include <Halide.h>
+
+#include "merge.h"
+
+namespace {
+
+class MergeAligned : public Halide::Generator<MergeAligned> {
+public:
+  // 'inputs' is really a series of raw 2d frames; extent[2] specifies the count
+  Input<Halide::Buffer<uint16_t>> inputs{"inputs", 3};
+  // precomputed alignment offsets (tile_x, tile_y, n, c) where c = 0 is x and
+  // c = 1 is y, e.g. from the align_frame pipeline
+  Input<Halide::Buffer<int16_t>> alignment{"alignment", 4};
+  // Merged buffer
+  Output<Halide::Buffer<uint16_t>> output{"output", 2};
+  // Uses the fixed-point temporal merge (see merge.h)
+  GeneratorParam<bool> fixed_point_merge{"fixed_point_merge", false};
+  // Uses the frequency-domain temporal merge (see merge.h); takes precedence
+  // over fixed_point_merge
+  GeneratorParam<bool> frequency_merge{"frequency_merge", false};
+
+  void generate() {
+    Var tx, ty, n;
+
+    Func alignment_clamped =
+        Halide::BoundaryConditions::repeat_edge(alignment);
+    Func offsets("merge_aligned_offsets");
+    offsets(tx, ty, n) = Halide::Tuple(alignment_clamped(tx, ty, n, 0),
+                                       alignment_clamped(tx, ty, n, 1));
+
+    Func merged =
+        frequency_merge
+            ? merge_frequency(inputs, inputs.width(), inputs.height(),
+                              inputs.dim(2).extent(), offsets)
+            : merge(inputs, inputs.width(), inputs.height(),
+                    inputs.dim(2).extent(), offsets, fixed_point_merge);
+    output = merged;
+  }
+};
+
+} // namespace
+
+HALIDE_REGISTER_GENERATOR(MergeAligned, merge_aligned)
@@ -0,0 +1,26 @@
+#include <Halide.h>
+
+#include "merge.h"
+
+namespace {
+
+class MergeFinish : public Halide::Generator<MergeFinish> {
+public:
+  // reference frame of the streaming merge
+  Input<Halide::Buffer<uint16_t>> reference{"reference", 2};
+  // accumulators from merge_frame (see MergeAccumulators in merge.h)
+  Input<Halide::Buffer<float>> sum{"sum", 4};
+  Input<Halide::Buffer<float>> weight{"weight", 2};
+  // Merged buffer
+  Output<Halide::Buffer<uint16_t>> output{"output", 2};
+
+  void generate() {
+    Func merged = merge_finish(reference, reference.width(),
+                               reference.height(), sum, weight);
+    output = merged;
+  }
+};
+
+} // namespace
+
+HALIDE_REGISTER_GENERATOR(MergeFinish, merge_finish)
@@ -0,0 +1,58 @@
+#include <Halide.h>
+
+#include "align.h"
+#include "merge.h"
+
+namespace {
+
+class MergeFrame : public Halide::Generator<MergeFrame> {
+public:
+  // alignment pyramid of the reference frame, from reference_pyramid
+  Input<Halide::Buffer<uint16_t>> reference_layer_0{"reference_layer_0", 2};
+  Input<Halide::Buffer<uint16_t>> reference_layer_1{"reference_layer_1", 2};
+  Input<Halide::Buffer<uint16_t>> reference_layer_2{"reference_layer_2", 2};
+  // the next alternate frame of the burst
+  Input<Halide::Buffer<uint16_t>> alternate{"alternate", 2};
+  // accumulators (see MergeAccumulators in merge.h); the outputs may be the
+  // same buffers as the inputs to update them in place
+  Input<Halide::Buffer<float>> sum_in{"sum_in", 4};
+  Input<Halide::Buffer<float>> weight_in{"weight_in", 2};
+  Output<Halide::Buffer<float>> sum{"sum", 4};
+  Output<Halide::Buffer<float>> weight{"weight", 2};
+
+  void generate() {
+    Var x, y, n, tx, ty;
+
+    Expr width = alternate.width();
+    Expr height = alternate.height();
+
+    std::vector<Func> ref_layers = {
+        Halide::BoundaryConditions::repeat_edge(reference_layer_0),
+        Halide::BoundaryConditions::repeat_edge(reference_layer_1),
+        Halide::BoundaryConditions::repeat_edge(reference_layer_2)};
+
+    Func imgs("merge_frame_input");
+    imgs(x, y, n) = alternate(x, y);
+
+    std::vector<Func> alt_layers = alignment_pyramid(imgs, width, height);
+
+    Func alignment_3d = align(ref_layers, alt_layers, width, height);
+
+    Func alignment("merge_frame_alignment");
+    alignment(tx, ty) = alignment_3d(tx, ty, 0);
+
+    Func alt_layer("merge_frame_layer");
+    alt_layer(x, y) = alt_layers[0](x, y, 0);
+
+    MergeAccumulators accumulators =
+        merge_accumulate(ref_layers[0], alternate, alt_layer, width, height,
+                         alignment, sum_in, weight_in);
+
+    sum = accumulators.sum;
+    weight = accumulators.weight;
+  }
+};
+
+} // namespace
+
+HALIDE_REGISTER_GENERATOR(MergeFrame, merge_frame)
@@ -0,0 +1,35 @@
+#include <Halide.h>
+
+#include "align.h"
+
+namespace {
+
+class ReferencePyramid : public Halide::Generator<ReferencePyramid> {
+public:
+  // reference frame of a streaming merge
+  Input<Halide::Buffer<uint16_t>> reference{"reference", 2};
+  // alignment pyramid layers of the reference, finest first. The caller
+  // allocates them with a margin around the image (negative mins) so that
+  // they cover every offset the alignment search can reach.
+  Output<Halide::Buffer<uint16_t>> layer_0{"layer_0", 2};
+  Output<Halide::Buffer<uint16_t>> layer_1{"layer_1", 2};
+  Output<Halide::Buffer<uint16_t>> layer_2{"layer_2", 2};
+
+  void generate() {
+    Var x, y, n;
+
+    Func imgs("reference_pyramid_input");
+    imgs(x, y, n) = reference(x, y);
+
+    std::vector<Func> layers =
+        alignment_pyramid(imgs, reference.width(), reference.height());
+
+    layer_0(x, y) = layers[0](x, y, 0);
+    layer_1(x, y) = layers[1](x, y, 0);
+    layer_2(x, y) = layers[2](x, y, 0);
+  }
+};
+
+} // namespace
+
+HALIDE_REGISTER_GENERATOR(ReferencePyramid, reference_pyramid)
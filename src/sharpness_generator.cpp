@@ -0,0 +1,22 @@
+#include <Halide.h>
+
+#include "align.h"
+
+namespace {
+
+class Sharpness : public Halide::Generator<Sharpness> {
+public:
+  // 'inputs' is really a series of raw 2d frames; extent[2] specifies the count
+  Input<Halide::Buffer<uint16_t>> inputs{"inputs", 3};
+  // Sharpness score of each frame, higher is sharper
+  Output<Halide::Buffer<float>> scores{"scores", 1};
+
+  void generate() {
+    scores = sharpness(inputs, inputs.width(), inputs.height(),
+                       inputs.dim(2).extent());
+  }
+};
+
+} // namespace
+
+HALIDE_REGISTER_GENERATOR(Sharpness, sharpness)
@@ -2,6 +2,7 @@
 
 #include "Halide.h"
 #include <algorithm>
+#include <cmath>
 #include <vector>
 
 using namespace Halide;
@@ -31,67 +32,130 @@ Func box_down2(Func input, std::string name) {
 }
 
 /*
- * gauss_down4 -- applies a 3x3 integer gauss kernel and downsamples an image by
- * 4 in one step.
+ * gauss_down4 -- applies a separable 5x5 integer gauss kernel and downsamples
+ * an image by 4 in one step. The taps (27, 61, 80, 61, 27) / 256 are the
+ * marginals (17, 38, 49, 38, 17) / 159 of the original 5x5 kernel scaled to a
+ * power of two total, so both passes use constant multiplies on 32 bits and
+ * one rounding shift at the end.
  */
 Func gauss_down4(Func input, std::string name) {
 
+  Func blur_y(name + "_y");
   Func output(name);
-  Buffer<uint32_t> k(5, 5, "gauss_down4_kernel_" + name);
-  k.translate({-2, -2});
 
   Var x, y, n;
-  RDom r(-2, 5, -2, 5);
 
-  // gaussian kernel
+  // vertical pass, only at the rows that survive the stride 4 downsample
+
+  blur_y(x, y, n) = 27 * u32(input(x, 4 * y - 2, n)) +
+                    61 * u32(input(x, 4 * y - 1, n)) +
+                    80 * u32(input(x, 4 * y, n)) +
+                    61 * u32(input(x, 4 * y + 1, n)) +
+                    27 * u32(input(x, 4 * y + 2, n));
 
-  k.fill(0);
-  k(-2, -2) = 2;
-  k(-1, -2) = 4;
-  k(0, -2) = 5;
-  k(1, -2) = 4;
-  k(2, -2) = 2;
-  k(-2, -1) = 4;
-  k(-1, -1) = 9;
-  k(0, -1) = 12;
-  k(1, -1) = 9;
-  k(2, -1) = 4;
-  k(-2, 0) = 5;
-  k(-1, 0) = 12;
-  k(0, 0) = 15;
-  k(1, 0) = 12;
-  k(2, 0) = 5;
-  k(-2, 1) = 4;
-  k(-1, 1) = 9;
-  k(0, 1) = 12;
-  k(1, 1) = 9;
-  k(2, 1) = 4;
-  k(-2, 2) = 2;
-  k(-1, 2) = 4;
-  k(0, 2) = 5;
-  k(1, 2) = 4;
-  k(2, 2) = 2;
-
-  // output with applied kernel and stride 4
+  // horizontal pass with stride 4; total weight is 256 * 256 = 1 << 16, so
+  // the sum stays below 65535 << 16 and fits in u32
 
   output(x, y, n) =
-      u16(sum(u32(input(4 * x + r.x, 4 * y + r.y, n) * k(r.x, r.y))) / 159);
+      u16((27 * blur_y(4 * x - 2, y, n) + 61 * blur_y(4 * x - 1, y, n) +
+           80 * blur_y(4 * x, y, n) + 61 * blur_y(4 * x + 1, y, n) +
+           27 * blur_y(4 * x + 2, y, n) + (1 << 15)) >>
+          16);
 
   ///////////////////////////////////////////////////////////////////////////
   // schedule
   ///////////////////////////////////////////////////////////////////////////
 
+  blur_y.compute_at(output, y).vectorize(x, 16);
+
   output.compute_root().parallel(y).vectorize(x, 16);
 
   return output;
 }
 
 /*
- * gauss_7x7 -- Applies a 7x7 gauss kernel with a std deviation of 4/3. Requires
- * its input to handle boundaries.
+ * gauss_fixed -- The u16 and i16 path of gauss. The kernel is quantized to
+ * integer taps summing to 256 and both passes are unrolled into constant
+ * multiplies on 32 bits, with a single rounding shift at the end.
+ */
+Func gauss_fixed(Func input, Buffer<float> k, std::string name) {
+
+  Func blur_x(name + "_x");
+  Func output(name);
+
+  Var x, y, c;
+
+  // quantize the taps; the rounding error goes to the center tap so that
+  // flat regions are reproduced exactly
+
+  const int k_min = k.dim(0).min();
+  const int k_max = k.dim(0).max();
+
+  std::vector<int> taps;
+  int total = 0;
+  for (int i = k_min; i <= k_max; i++) {
+    taps.push_back(int(std::lround(k(i) * 256.f)));
+    total += taps.back();
+  }
+  taps[-k_min] += 256 - total;
+
+  std::vector<Var> args = {x, y};
+  if (input.dimensions() == 3) {
+    args.push_back(c);
+  }
+
+  auto shifted = [&](Func f, int dim, int offset) {
+    std::vector<Expr> coords(args.begin(), args.end());
+    coords[dim] += offset;
+    return f(coords);
+  };
+
+  // |i16| * 256 * 256 and u16 * 256 * 256 both fit in 32 bits
+
+  const Type type = input.types()[0];
+  const Type wide = type.is_int() ? Int(32) : UInt(32);
+
+  Expr sum_x = cast(wide, 0);
+  for (int i = k_min; i <= k_max; i++) {
+    sum_x += taps[i - k_min] * cast(wide, shifted(input, 0, i));
+  }
+  blur_x(args) = sum_x;
+
+  // each pass scales by 256, so the total weight is 1 << 16
+
+  Expr sum_y = cast(wide, 0);
+  for (int i = k_min; i <= k_max; i++) {
+    sum_y += taps[i - k_min] * shifted(blur_x, 1, i);
+  }
+  output(args) = cast(type, (sum_y + (1 << 15)) >> 16);
+
+  ///////////////////////////////////////////////////////////////////////////
+  // schedule
+  ///////////////////////////////////////////////////////////////////////////
+
+  Var xi, yi;
+
+  blur_x.compute_at(output, x).vectorize(x, 16);
+
+  output.compute_root()
+      .tile(x, y, xi, yi, 256, 128)
+      .vectorize(xi, 16)
+      .parallel(y);
+
+  return output;
+}
+
+/*
+ * gauss -- Applies a separable gauss kernel k over r. Requires its input to
+ * handle boundaries. u16 and i16 inputs are blurred in fixed point (see
+ * gauss_fixed), anything else in float.
  */
 Func gauss(Func input, Buffer<float> k, RDom r, std::string name) {
 
+  if (input.types()[0] == UInt(16) || input.types()[0] == Int(16)) {
+    return gauss_fixed(input, k, name);
+  }
+
   Func blur_x(name + "_x");
   Func output(name);
 
@@ -105,9 +169,6 @@ Func gauss(Func input, Buffer<float> k, RDom r, std::string name) {
 
     val = sum(blur_x(x, y + r) * k(r));
 
-    if (input.types()[0] == UInt(16))
-      val = u16(val);
-
     output(x, y) = val;
   } else {
 
@@ -115,9 +176,6 @@ Func gauss(Func input, Buffer<float> k, RDom r, std::string name) {
 
     val = sum(blur_x(x, y + r, c) * k(r));
 
-    if (input.types()[0] == UInt(16))
-      val = u16(val);
-
     output(x, y, c) = val;
   }
 
@@ -191,6 +249,121 @@ Func gauss_15x15(Func input, std::string name) {
   return gauss(input, k, r, name);
 }
 
+/*
+ * gauss_iir -- Approximates a gaussian blur with the recursive filter of Young
+ * and van Vliet: a causal and an anticausal third order pass along each axis,
+ * so the cost does not depend on sigma.
+ */
+Func gauss_iir(Func input, float sigma, Expr width, Expr height,
+               std::string name) {
+
+  Func causal_x(name + "_causal_x");
+  Func blur_x(name + "_x");
+  Func causal_y(name + "_causal_y");
+  Func blur_y(name + "_y");
+  Func output(name);
+
+  Var x, y, c;
+
+  // filter coefficients, normalized to unit gain
+
+  float q = sigma >= 2.5f
+                ? 0.98711f * sigma - 0.96330f
+                : 3.97156f - 4.14554f * std::sqrt(1.f - 0.26891f * sigma);
+  float q2 = q * q, q3 = q2 * q;
+
+  float b0 = 1.57825f + 2.44413f * q + 1.4281f * q2 + 0.422205f * q3;
+  float a1 = (2.44413f * q + 2.85619f * q2 + 1.26661f * q3) / b0;
+  float a2 = -(1.4281f * q2 + 1.26661f * q3) / b0;
+  float a3 = 0.422205f * q3 / b0;
+  float gain = 1.f - (a1 + a2 + a3);
+
+  std::vector<Var> args = {x, y};
+  if (input.dimensions() == 3) {
+    args.push_back(c);
+  }
+
+  auto at = [&](Func f, int dim, Expr pos) {
+    std::vector<Expr> coords(args.begin(), args.end());
+    coords[dim] = pos;
+    return f(coords);
+  };
+
+  // each pass is seeded with its input beyond the scanned range, which is the
+  // steady state of the filter for an edge that is continued as a constant
+
+  RDom rx(0, width);
+  RDom ry(0, height);
+
+  Expr fwd_x = rx;
+  Expr bwd_x = width - 1 - rx;
+  Expr fwd_y = ry;
+  Expr bwd_y = height - 1 - ry;
+
+  causal_x(args) = f32(input(args));
+  at(causal_x, 0, fwd_x) = gain * f32(at(input, 0, fwd_x)) +
+                           a1 * at(causal_x, 0, fwd_x - 1) +
+                           a2 * at(causal_x, 0, fwd_x - 2) +
+                           a3 * at(causal_x, 0, fwd_x - 3);
+
+  blur_x(args) = causal_x(args);
+  at(blur_x, 0, bwd_x) = gain * at(causal_x, 0, bwd_x) +
+                         a1 * at(blur_x, 0, bwd_x + 1) +
+                         a2 * at(blur_x, 0, bwd_x + 2) +
+                         a3 * at(blur_x, 0, bwd_x + 3);
+
+  causal_y(args) = blur_x(args);
+  at(causal_y, 1, fwd_y) = gain * at(blur_x, 1, fwd_y) +
+                           a1 * at(causal_y, 1, fwd_y - 1) +
+                           a2 * at(causal_y, 1, fwd_y - 2) +
+                           a3 * at(causal_y, 1, fwd_y - 3);
+
+  blur_y(args) = causal_y(args);
+  at(blur_y, 1, bwd_y) = gain * at(causal_y, 1, bwd_y) +
+                         a1 * at(blur_y, 1, bwd_y + 1) +
+                         a2 * at(blur_y, 1, bwd_y + 2) +
+                         a3 * at(blur_y, 1, bwd_y + 3);
+
+  if (input.types()[0] == UInt(16)) {
+    output(args) = u16_sat(blur_y(args) + 0.5f);
+  } else if (input.types()[0] == Int(16)) {
+    output(args) = i16_sat(round(blur_y(args)));
+  } else {
+    output(args) = blur_y(args);
+  }
+
+  ///////////////////////////////////////////////////////////////////////////
+  // schedule
+  ///////////////////////////////////////////////////////////////////////////
+
+  // the horizontal scans are vectorized across rows, the vertical ones
+  // across columns
+
+  Var xo, xi, yo, yi;
+
+  for (Func f : {causal_x, blur_x}) {
+    f.compute_root().parallel(y).vectorize(x, 8);
+    f.update()
+        .split(y, yo, yi, 64)
+        .reorder(yi, rx.x, yo)
+        .vectorize(yi, 8)
+        .parallel(yo);
+  }
+
+  for (Func f : {causal_y, blur_y}) {
+    f.compute_root().parallel(y).vectorize(x, 8);
+    f.update()
+        .split(x, xo, xi, 64)
+        .reorder(xi, ry.x, xo)
+        .vectorize(xi, 8)
+        .parallel(xo);
+  }
+
+  output.compute_root().parallel(y).vectorize(x, 16);
+
+  return output;
+}
+
 /*
  * diff -- Computes difference between two integer functions
  */
@@ -209,33 +382,35 @@ Func diff(Func im1, Func im2, std::string name) {
   return output;
 }
 
+namespace {
+
 /*
- * gamma_correct -- Takes a single or multi-channel linear image and applies
- * gamma correction as described here: http://www.color.org/sRGB.xalter. See
- * formulas 1.2a and 1.2b
+ * gamma_table -- Tabulates a u16 -> u16 curve over all 65536 inputs. The
+ * table is computed once per process and baked into the pipeline as a
+ * constant buffer, so pipelines only gather from it.
  */
-Func gamma_correct(Func input) {
-
-  Func output("gamma_correct_output");
+Buffer<uint16_t> gamma_table(float (*curve)(float)) {
+  Buffer<uint16_t> table(65536);
+  table.for_each_element([&](int v) {
+    table(v) = uint16_t(std::clamp(curve(float(v)), 0.f, 65535.f));
+  });
+  return table;
+}
 
-  Var x, y, c;
+/*
+ * gamma_lookup -- Applies a tabulated curve to a single or multi-channel u16
+ * image.
+ */
+Func gamma_lookup(Func input, Buffer<uint16_t> table, std::string name) {
 
-  // constants for gamma correction
+  Func output(name);
 
-  int cutoff = 200; // ceil(0.00304 * UINT16_MAX)
-  float gamma_toe = 12.92;
-  float gamma_pow = 0.416667;   // 1 / 2.4
-  float gamma_fac = 680.552897; // 1.055 * UINT16_MAX ^ (1 - gamma_pow);
-  float gamma_con = -3604.425;  // -0.055 * UINT16_MAX
+  Var x, y, c;
 
   if (input.dimensions() == 2) {
-    output(x, y) =
-        u16(select(input(x, y) < cutoff, gamma_toe * input(x, y),
-                   gamma_fac * pow(input(x, y), gamma_pow) + gamma_con));
+    output(x, y) = table(i32(input(x, y)));
   } else {
-    output(x, y, c) =
-        u16(select(input(x, y, c) < cutoff, gamma_toe * input(x, y, c),
-                   gamma_fac * pow(input(x, y, c), gamma_pow) + gamma_con));
+    output(x, y, c) = table(i32(input(x, y, c)));
   }
 
   ///////////////////////////////////////////////////////////////////////////
@@ -247,48 +422,77 @@ Func gamma_correct(Func input) {
   return output;
 }
 
+} // namespace
+
 /*
- * gamma_inverse -- Takes a single or multi-channel image and undoes gamma
- * correction to return in to linear RGB space.
+ * gamma_correct -- Takes a single or multi-channel linear image and applies
+ * gamma correction as described here: http://www.color.org/sRGB.xalter. See
+ * formulas 1.2a and 1.2b. The curve is looked up in a 65536 entry table.
  */
-Func gamma_inverse(Func input) {
+Func gamma_correct(Func input) {
 
-  Func output("gamma_inverse_output");
+  // constants for gamma correction
 
-  Var x, y, c;
+  static Buffer<uint16_t> table = gamma_table([](float v) {
+    const int cutoff = 200; // ceil(0.00304 * UINT16_MAX)
+    const float gamma_toe = 12.92;
+    const float gamma_pow = 0.416667;   // 1 / 2.4
+    const float gamma_fac = 680.552897; // 1.055 * UINT16_MAX ^ (1 - gamma_pow);
+    const float gamma_con = -3604.425;  // -0.055 * UINT16_MAX
+
+    return v < cutoff ? gamma_toe * v
+                      : gamma_fac * std::pow(v, gamma_pow) + gamma_con;
+  });
+
+  return gamma_lookup(input, table, "gamma_correct_output");
+}
+
+/*
+ * gamma_inverse -- Takes a single or multi-channel image and undoes gamma
+ * correction to return in to linear RGB space. The curve is looked up in a
+ * 65536 entry table.
+ */
+Func gamma_inverse(Func input) {
 
   // constants for inverse gamma correction
 
-  int cutoff = 2575;        // ceil(1/0.00304 * UINT16_MAX)
-  float gamma_toe = 0.0774; // 1 / 12.92
-  float gamma_pow = 2.4;
-  float gamma_fac = 57632.49226; // 1 / 1.055 ^ gamma_pow * U_INT16_MAX;
-  float gamma_con = 0.055;
+  static Buffer<uint16_t> table = gamma_table([](float v) {
+    const int cutoff = 2575;        // ceil(1/0.00304 * UINT16_MAX)
+    const float gamma_toe = 0.0774; // 1 / 12.92
+    const float gamma_pow = 2.4;
+    const float gamma_fac = 57632.49226; // 1 / 1.055 ^ gamma_pow * U_INT16_MAX;
+    const float gamma_con = 0.055;
 
-  if (input.dimensions() == 2) {
-    output(x, y) = u16(select(
-        input(x, y) < cutoff, gamma_toe * input(x, y),
-        pow(f32(input(x, y)) / 65535.f + gamma_con, gamma_pow) * gamma_fac));
-  } else {
-    output(x, y, c) = u16(select(
-        input(x, y, c) < cutoff, gamma_toe * input(x, y),
-        pow(f32(input(x, y, c)) / 65535.f + gamma_con, gamma_pow) * gamma_fac));
-  }
+    return v < cutoff
+               ? gamma_toe * v
+               : std::pow(v / 65535.f + gamma_con, gamma_pow) * gamma_fac;
+  });
 
-  ///////////////////////////////////////////////////////////////////////////
-  // schedule
-  ///////////////////////////////////////////////////////////////////////////
+  return gamma_lookup(input, table, "gamma_inverse_output");
+}
 
-  output.compute_root().parallel(y).vectorize(x, 16);
+/*
+ * yuv_to_f32 -- Returns a YUV sample as f32, undoing the fixed-point scale
+ * of i16 samples.
+ */
+Expr yuv_to_f32(Expr value) {
+  return value.type() == Int(16) ? f32(value) * 2.f : value;
+}
 
-  return output;
+/*
+ * yuv_from_f32 -- Stores an f32 YUV value as a sample of type t, rounding to
+ * the fixed-point scale if t is i16.
+ */
+Expr yuv_from_f32(Expr value, Type t) {
+  return t == Int(16) ? i16_sat(round(value * 0.5f)) : value;
 }
 
 /*
  * rgb_to_yuv -- converts a linear rgb image to a linear yuv image. Note that
- * the output is in float32
+ * the output is in float32, or in int16 holding half the values with
+ * fixed_point.
  */
-Func rgb_to_yuv(Func input) {
+Func rgb_to_yuv(Func input, bool fixed_point) {
 
   Func output("rgb_to_yuv_output");
 
@@ -298,11 +502,16 @@ Func rgb_to_yuv(Func input) {
   Expr g = input(x, y, 1);
   Expr b = input(x, y, 2);
 
-  output(x, y, c) = f32(0);
+  Type t = fixed_point ? Int(16) : Float(32);
+
+  output(x, y, c) = cast(t, 0);
 
-  output(x, y, 0) = 0.298900f * r + 0.587000f * g + 0.114000f * b;  // Y
-  output(x, y, 1) = -0.168935f * r - 0.331655f * g + 0.500590f * b; // U
-  output(x, y, 2) = 0.499813f * r - 0.418531f * g - 0.081282f * b;  // V
+  output(x, y, 0) =
+      yuv_from_f32(0.298900f * r + 0.587000f * g + 0.114000f * b, t); // Y
+  output(x, y, 1) =
+      yuv_from_f32(-0.168935f * r - 0.331655f * g + 0.500590f * b, t); // U
+  output(x, y, 2) =
+      yuv_from_f32(0.499813f * r - 0.418531f * g - 0.081282f * b, t); // V
 
   ///////////////////////////////////////////////////////////////////////////
   // schedule
@@ -318,7 +527,8 @@ Func rgb_to_yuv(Func input) {
 }
 
 /*
- * yuv_to_rgb -- Converts a linear yuv image to a linear rgb image.
+ * yuv_to_rgb -- Converts a linear yuv image (f32 or fixed-point i16) to a
+ * linear rgb image.
  */
 Func yuv_to_rgb(Func input) {
 
@@ -326,9 +536,9 @@ Func yuv_to_rgb(Func input) {
 
   Var x, y, c;
 
-  Expr Y = input(x, y, 0);
-  Expr U = input(x, y, 1);
-  Expr V = input(x, y, 2);
+  Expr Y = yuv_to_f32(input(x, y, 0));
+  Expr U = yuv_to_f32(input(x, y, 1));
+  Expr V = yuv_to_f32(input(x, y, 2));
 
   output(x, y, c) = u16(0);
 
@@ -9,22 +9,33 @@
 Halide::Func box_down2(Halide::Func input, std::string name);
 
 /*
- * gauss_down4 -- Blurs and downsamples input by 4
+ * gauss_down4 -- Blurs and downsamples input by 4. Uses a separable integer
+ * approximation of the former 25-tap kernel (weights / 159); flat regions are
+ * reproduced exactly and the output deviates from the former kernel by at most
+ * 661 (1.0% of full scale) for adversarial inputs.
  */
 Halide::Func gauss_down4(Halide::Func input, std::string name);
 
 /*
  * gauss_7x7 -- Blurs its input with a 7x7 gaussian kernel. Requires input
- * to handle boundaries. Std dev = 4/3
+ * to handle boundaries. Std dev = 4/3. u16 inputs are blurred in fixed point.
  */
 Halide::Func gauss_7x7(Halide::Func input, std::string name);
 
 /*
  * gauss_15x15 -- Blurs its input with a 15x15 gaussian kernel. Requires input
- * to handle boundaries. Std dev = 8/3
+ * to handle boundaries. Std dev = 8/3. u16 inputs are blurred in fixed point.
  */
 Halide::Func gauss_15x15(Halide::Func input, std::string name);
 
+/*
+ * gauss_iir -- Blurs the region [0, width) x [0, height) of its input with a
+ * recursive approximation of a gaussian kernel of std dev sigma, whose cost
+ * does not depend on sigma. Requires input to handle boundaries.
+ */
+Halide::Func gauss_iir(Halide::Func input, float sigma, Halide::Expr width,
+                       Halide::Expr height, std::string name);
+
 /*
  * diff -- Computes difference between two integer functions
  */
@@ -45,12 +56,26 @@ Halide::Func gamma_inverse(Halide::Func input);
 
 /*
  * rgb_to_yuv -- converts a u16 linear rgb image to an f32 linear yuv image.
+ * With fixed_point the output is i16 holding half of each value instead, in
+ * half the memory. Rounding to that scale costs at most 1 (in u16 units) per
+ * stored stage, and every YUV stage accepts either representation, so a chain
+ * of n stages deviates from float by at most n * 1.77 per RGB channel after
+ * yuv_to_rgb (the largest YUV to RGB coefficient), under 1/100 of an 8-bit
+ * step per stage.
  */
-Halide::Func rgb_to_yuv(Halide::Func input);
+Halide::Func rgb_to_yuv(Halide::Func input, bool fixed_point = false);
 
 /*
- * yuv_to_rgb -- Converts f32 YUV image to u16 RGB linear image
+ * yuv_to_rgb -- Converts an f32 or fixed-point i16 YUV image to a u16 RGB
+ * linear image
  */
 Halide::Func yuv_to_rgb(Halide::Func input);
 
+/*
+ * yuv_to_f32, yuv_from_f32 -- Read a YUV sample of either representation as
+ * f32, and store an f32 value as a sample of type t.
+ */
+Halide::Expr yuv_to_f32(Halide::Expr value);
+Halide::Expr yuv_from_f32(Halide::Expr value, Halide::Type t);
+
 #endif